@@ -68,6 +68,9 @@ struct cmdarg {
     int type;
     char *string;
     union arg_union arg;
+
+    /* Non-zero when the arg and its string came from the scratch arena. */
+    int scratch;
     struct list_head node;
 };
 #define ARG_STRING(elt) args[elt]->string
@@ -107,22 +110,99 @@ typedef struct {
     char *alias;
 } alias_t;
 
+/* What undo keeps of a frame. frame_dump has the same, as text. */
+struct frame_state {
+    int number;
+    int x, y, width, height;
+    int last_access;
+    unsigned int dedicated;
+    Window window;
+};
+
+/*
+ * A layout of a vscreen's frames. Entries are reused as the history goes
+ * round, so frames has room for size of them and the first nframes are used.
+ */
 typedef struct rp_frame_undo {
-    char *frames;
     rp_vscreen *vscreen;
-    struct list_head node;
+    int screen_width, screen_height;
+    struct frame_state *frames;
+    int nframes, size;
 } rp_frame_undo;
 
+/*
+ * A ring of layouts, holding the last defaults.maxundos of them. The oldest
+ * is at first and the newest is count - 1 after it.
+ */
+struct frame_history {
+    rp_frame_undo *entries;
+    int size, first, count;
+};
+
+/*
+ * A command string that has been run before, with the command it resolved to
+ * and the sbuf tokens parse_args produced for its arguments. Bindings, hooks
+ * and aliases run the same strings over and over, so command() keeps these
+ * around rather than tokenizing again on every invocation.
+ */
+struct arg_cache_entry {
+    char *data;
+    struct user_command *uc;
+    struct list_head tokens;
+};
+
+#define ARG_CACHE_SIZE 64
+
+/*
+ * A command string resolved ahead of time, for bindings and hooks. Arguments
+ * that mean the same thing whenever they are read are converted once. Frames,
+ * windows, vscreens and keymaps may come and go, so those are kept as tokens
+ * and read again on every run.
+ */
+struct rp_compiled_cmd {
+    char *data;
+
+    /* NULL when data has to go through command() every time. */
+    struct user_command *uc;
+
+    /* The alias table generation uc was resolved against. */
+    int alias_generation;
+
+    /*
+     * The nargs arguments given in data. A NULL entry in args has its
+     * token in deferred instead. args is NULL terminated.
+     */
+    int nargs;
+    struct cmdarg **args;
+    struct sbuf **deferred;
+
+    /* Non-zero when none of the args are deferred. */
+    int constant;
+
+    /* A binding may unbind itself while it runs. */
+    int refs;
+};
+
 static LIST_HEAD(user_commands);
 static LIST_HEAD(rp_keymaps);
 static LIST_HEAD(set_vars);
-static LIST_HEAD(rp_frame_undos);
-static LIST_HEAD(rp_frame_redos);
+static struct frame_history rp_frame_undos;
+static struct frame_history rp_frame_redos;
 
+/* Sorted by name, so lookups can bisect. */
 static alias_t *alias_list;
 static int alias_list_size;
 static int alias_list_last;
 
+/* user_commands sorted by name, built once by init_user_commands. */
+static struct user_command **command_table;
+static int command_table_size;
+
+static struct arg_cache_entry arg_cache[ARG_CACHE_SIZE];
+
+/* Bumped whenever an alias is added or removed. */
+static int alias_generation;
+
 static const char invalid_negative_arg[] = "invalid negative argument";
 
 /* setter function prototypes */
@@ -153,6 +233,7 @@ static cmdret *set_onlyborder(struct cmdarg **args);
 static cmdret *set_padding(struct cmdarg **args);
 static cmdret *set_resizefmt(struct cmdarg **args);
 static cmdret *set_resizeunit(struct cmdarg **args);
+static cmdret *set_rootkeygrab(struct cmdarg **args);
 static cmdret *set_rudeness(struct cmdarg **args);
 
 static cmdret *set_topkmap(struct cmdarg **args);
@@ -218,6 +299,7 @@ static cmdret *cmd_iother(int interactive, struct cmdarg **args);
 static cmdret *cmd_iprev(int interactive, struct cmdarg **args);
 static cmdret *cmd_kill(int interactive, struct cmdarg **args);
 static cmdret *cmd_lastmsg(int interactive, struct cmdarg **args);
+static cmdret *cmd_latency(int interactive, struct cmdarg **args);
 static cmdret *cmd_link(int interactive, struct cmdarg **args);
 static cmdret *cmd_listhook(int interactive, struct cmdarg **args);
 static cmdret *cmd_meta(int interactive, struct cmdarg **args);
@@ -253,6 +335,7 @@ static cmdret *cmd_sfdump(int interactive, struct cmdarg **args);
 static cmdret *cmd_sfrestore(int interactive, struct cmdarg **args);
 static cmdret *cmd_shrink(int interactive, struct cmdarg **args);
 static cmdret *cmd_smove(int interactive, struct cmdarg **args);
+static cmdret *cmd_snapshot(int interactive, struct cmdarg **args);
 static cmdret *cmd_source(int interactive, struct cmdarg **args);
 static cmdret *cmd_sselect(int interactive, struct cmdarg **args);
 static cmdret *cmd_stick(int interactive, struct cmdarg **args);
@@ -271,6 +354,9 @@ static cmdret *cmd_windowselector(int interactive, struct cmdarg **args);
 static cmdret *cmd_applauncher(int interactive, struct cmdarg **args);
 static cmdret *cmd_wallpaper(int interactive, struct cmdarg **args);
 
+static cmdret *parse_keydesc(char *keydesc, struct rp_key *key);
+static void arg_cache_flush(void);
+
 static void
 add_set_var(char *name, cmdret *(*fn) (struct cmdarg **), int nargs, ...)
 {
@@ -337,6 +423,7 @@ static void init_set_vars(void)
                 "", arg_NUMBER, "", arg_NUMBER);
     add_set_var("resizefmt", set_resizefmt, 1, "", arg_REST);
     add_set_var("resizeunit", set_resizeunit, 1, "", arg_NUMBER);
+    add_set_var("rootkeygrab", set_rootkeygrab, 1, "", arg_NUMBER);
     add_set_var("rudeness", set_rudeness, 1, "", arg_NUMBER);
 
     add_set_var("topkmap", set_topkmap, 1, "", arg_STRING);
@@ -392,6 +479,60 @@ static void user_command_free(struct user_command *cmd)
     free(cmd);
 }
 
+/*
+ * Compare the len characters at s against name, as though s were NUL
+ * terminated there.
+ */
+static int name_cmp(const char *name, const char *s, size_t len)
+{
+    int c;
+
+    c = strncmp(name, s, len);
+    if (c == 0 && name[len] != '\0')
+        return 1;
+    return c;
+}
+
+static int user_command_cmp(const void *a, const void *b)
+{
+    return strcmp((*(struct user_command **) a)->name,
+                  (*(struct user_command **) b)->name);
+}
+
+static void init_command_table(void)
+{
+    struct user_command *cur;
+    int i = 0;
+
+    command_table_size = list_size(&user_commands);
+    command_table = xmalloc(sizeof(struct user_command *) *
+                            command_table_size);
+    list_for_each_entry(cur, &user_commands, node) {
+        command_table[i++] = cur;
+    }
+    qsort(command_table, command_table_size, sizeof(struct user_command *),
+          user_command_cmp);
+}
+
+/* Find the command named by the first len characters of name. */
+static struct user_command *find_user_command(const char *name, size_t len)
+{
+    int lo = 0, hi = command_table_size - 1, mid, c;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = name_cmp(command_table[mid]->name, name, len);
+        if (c == 0)
+            return command_table[mid];
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return NULL;
+}
+
 void init_user_commands(void)
 {
     /* @begin (tag required for genrpbindings) */
@@ -456,6 +597,8 @@ void init_user_commands(void)
     add_command("iprev", cmd_iprev, 0, 0, 0);
     add_command("kill", cmd_kill, 0, 0, 0);
     add_command("lastmsg", cmd_lastmsg, 0, 0, 0);
+    add_command("latency", cmd_latency, 2, 0, 0, "", arg_STRING, "File: ",
+                arg_STRING);
     add_command("link", cmd_link, 2, 1, 1,
                 "Key: ", arg_STRING, "Keymap: ", arg_KEYMAP);
     add_command("listhook", cmd_listhook, 1, 1, 1, "Hook: ", arg_HOOK);
@@ -497,6 +640,7 @@ void init_user_commands(void)
     add_command("shrink", cmd_shrink, 0, 0, 0);
     add_command("source", cmd_source, 1, 1, 1, "File: ", arg_REST);
     add_command("smove", cmd_smove, 1, 1, 1, "Screen: ", arg_NUMBER);
+    add_command("snapshot", cmd_snapshot, 1, 0, 0, "", arg_STRING);
     add_command("sselect", cmd_sselect, 1, 1, 1, "Screen: ", arg_NUMBER);
     add_command("stick", cmd_stick, 0, 0, 0);
     add_command("swap", cmd_swap, 2, 1, 1,
@@ -523,79 +667,144 @@ void init_user_commands(void)
                 "Wallpaper: ", arg_REST);
     /* @end (tag required for genrpbindings) */
 
+    init_command_table();
     init_set_vars();
 }
 
-/* Delete all entries in the redo list. */
-static void clear_frame_redos(void)
+/* Make room in h for size layouts, keeping the newest ones. */
+static void frame_history_resize(struct frame_history *h, int size)
 {
-    rp_frame_undo *cur;
-    struct list_head *tmp, *iter;
+    rp_frame_undo *entries;
+    int i, keep = h->count < size ? h->count : size;
 
-    list_for_each_safe_entry(cur, iter, tmp, &rp_frame_redos, node) {
-        free(cur->frames);
-        list_del(&(cur->node));
+    entries = NULL;
+    if (size) {
+        entries = xmalloc(size * sizeof(rp_frame_undo));
+        memset(entries, 0, size * sizeof(rp_frame_undo));
     }
+
+    /* The newest ones go to the front of the new ring, the rest are lost. */
+    for (i = 0; i < h->count; i++) {
+        rp_frame_undo *u = &h->entries[(h->first + i) % h->size];
+
+        if (i >= h->count - keep)
+            entries[i - (h->count - keep)] = *u;
+        else
+            free(u->frames);
+    }
+
+    /* Entries never used hold no frames, but may have room from before. */
+    for (i = h->count; i < h->size; i++)
+        free(h->entries[(h->first + i) % h->size].frames);
+
+    free(h->entries);
+    h->entries = entries;
+    h->size = size;
+    h->first = 0;
+    h->count = keep;
 }
 
-static void del_frame_undo(rp_frame_undo *u)
+/* Delete all the layouts in h. */
+static void frame_history_clear(struct frame_history *h)
 {
-    if (!u)
+    h->first = h->count = 0;
+}
+
+/* Save the layout of vscreen as the newest in h, dropping the oldest. */
+static void frame_history_push(struct frame_history *h, rp_vscreen *vscreen)
+{
+    rp_frame_undo *u;
+    rp_frame *cur;
+    rp_window *win;
+    int n, i = 0;
+
+    if (h->size != defaults.maxundos)
+        frame_history_resize(h, defaults.maxundos);
+    if (h->size == 0)
         return;
 
-    free(u->frames);
-    list_del(&(u->node));
-    free(u);
+    if (h->count == h->size) {
+        u = &h->entries[h->first];
+        h->first = (h->first + 1) % h->size;
+    } else {
+        u = &h->entries[(h->first + h->count) % h->size];
+        h->count++;
+    }
+
+    n = num_frames(vscreen);
+    if (n > u->size) {
+        u->size = n;
+        u->frames = xrealloc(u->frames, n * sizeof(struct frame_state));
+    }
+
+    u->vscreen = vscreen;
+    u->screen_width = vscreen->screen->width;
+    u->screen_height = vscreen->screen->height;
+    u->nframes = n;
+
+    list_for_each_entry(cur, &vscreen->frames, node) {
+        /* Like frame_dump, keep the X11 window ID rather than win_number. */
+        win = find_window_number(cur->win_number);
+
+        u->frames[i].number = cur->number;
+        u->frames[i].x = cur->x;
+        u->frames[i].y = cur->y;
+        u->frames[i].width = cur->width;
+        u->frames[i].height = cur->height;
+        u->frames[i].last_access = cur->last_access;
+        u->frames[i].dedicated = cur->dedicated;
+        u->frames[i].window = win ? win->w : 0;
+        i++;
+    }
+}
+
+/*
+ * Take the newest layout off h. It stays good until the next one is pushed
+ * on h.
+ */
+static rp_frame_undo *frame_history_pop(struct frame_history *h)
+{
+    if (h->count == 0)
+        return NULL;
+
+    h->count--;
+    return &h->entries[(h->first + h->count) % h->size];
 }
 
 void clear_frame_undos(void)
 {
-    while (list_size(&rp_frame_undos) > 0) {
-        /* Delete the oldest node */
-        rp_frame_undo *cur;
-        list_last(cur, &rp_frame_undos, node);
-        del_frame_undo(cur);
-    }
+    frame_history_clear(&rp_frame_undos);
+    frame_history_clear(&rp_frame_redos);
+    frame_history_resize(&rp_frame_undos, 0);
+    frame_history_resize(&rp_frame_redos, 0);
 }
 
 static void push_frame_undo(rp_vscreen *vscreen)
 {
-    rp_frame_undo *cur;
+    frame_history_push(&rp_frame_undos, vscreen);
 
-    if (list_size(&rp_frame_undos) > defaults.maxundos) {
-        /* Delete the oldest node */
-        list_last(cur, &rp_frame_undos, node);
-        del_frame_undo(cur);
-    }
-    cur = xmalloc(sizeof(rp_frame_undo));
-    cur->frames = fdump(vscreen);
-    cur->vscreen = vscreen;
-    list_add(&cur->node, &rp_frame_undos);
+    /* The layout is about to change. */
+    snapshot_touch();
     /*
      * Since we're creating new frames the redo list is now invalid, so
      * clear it.
      */
-    clear_frame_redos();
+    frame_history_clear(&rp_frame_redos);
 }
 
-static rp_frame_undo *pop_frame_list(struct list_head *undo_list,
-                                     struct list_head *redo_list)
+static rp_frame_undo *pop_frame_list(struct frame_history *undo_list,
+                                     struct frame_history *redo_list)
 {
-    rp_vscreen *vscreen = rp_current_vscreen;
-    rp_frame_undo *first, *new;
+    rp_frame_undo *first;
 
     /* Is there something to restore? */
-    list_first(first, undo_list, node);
-    if (!first)
+    if ((first = frame_history_pop(undo_list)) == NULL)
         return NULL;
 
     /* First save the current layout into undo */
-    new = xmalloc(sizeof(rp_frame_undo));
-    new->frames = fdump(vscreen);
-    new->vscreen = vscreen;
-    list_add(&new->node, redo_list);
+    frame_history_push(redo_list, rp_current_vscreen);
 
-    list_del(&(first->node));
+    snapshot_touch();
     return first;
 }
 
@@ -624,35 +833,74 @@ rp_action *find_keybinding_by_action(char *action, rp_keymap *map)
     return NULL;
 }
 
+static unsigned int
+keymap_hash(KeySym keysym, unsigned int state, int size)
+{
+    unsigned long h;
+
+    h = (unsigned long) keysym * 2654435761UL ^ state * 40503UL;
+    return (h ^ (h >> 16)) & (size - 1);
+}
+
+static void keymap_index_insert(rp_keymap *map, int i)
+{
+    unsigned int h;
+
+    h = keymap_hash(map->actions[i].key, map->actions[i].state,
+                    map->index_size);
+    while (map->index[h] != -1)
+        h = (h + 1) & (map->index_size - 1);
+    map->index[h] = i;
+}
+
+/* Rebuild the hash index after the actions table was resized or shifted. */
+static void keymap_reindex(rp_keymap *map)
+{
+    int i;
+
+    if (map->index_size != map->actions_size * 2) {
+        map->index_size = map->actions_size * 2;
+        map->index = xrealloc(map->index, sizeof(int) * map->index_size);
+    }
+    for (i = 0; i < map->index_size; i++)
+        map->index[i] = -1;
+    for (i = 0; i < map->actions_last; i++)
+        keymap_index_insert(map, i);
+}
+
 rp_action *find_keybinding(KeySym keysym, unsigned int state,
                            rp_keymap *map)
 {
+    unsigned int h;
     int i;
-    for (i = 0; i < map->actions_last; i++) {
+
+    h = keymap_hash(keysym, state, map->index_size);
+    while ((i = map->index[h]) != -1) {
         if (map->actions[i].key == keysym &&
             map->actions[i].state == state)
             return &map->actions[i];
+        h = (h + 1) & (map->index_size - 1);
     }
     return NULL;
 }
 
+/*
+ * Parse the key description once and look it up in the index, rather than
+ * formatting every binding in the map to compare against desc.
+ */
 static char *find_command_by_keydesc(char *desc, rp_keymap *map)
 {
-    int i = 0;
-    char *keysym_name;
+    struct rp_key key;
+    rp_action *action;
+    cmdret *ret;
 
-    while (i < map->actions_last) {
-        keysym_name = keysym_to_string(map->actions[i].key,
-                                       map->actions[i].state);
-        if (!strcmp(keysym_name, desc)) {
-            free(keysym_name);
-            return map->actions[i].data;
-        }
-        free(keysym_name);
-        i++;
+    if ((ret = parse_keydesc(desc, &key))) {
+        cmdret_free(ret);
+        return NULL;
     }
 
-    return NULL;
+    action = find_keybinding(key.sym, key.state, map);
+    return action ? action->data : NULL;
 }
 
 static char *resolve_command_from_keydesc(char *desc, int depth,
@@ -687,37 +935,42 @@ add_keybinding(KeySym keysym, int state, char *cmd, rp_keymap *map)
     map->actions[map->actions_last].state = state;
     /* free this on shutdown, or re/unbinding */
     map->actions[map->actions_last].data = xstrdup(cmd);
+    map->actions[map->actions_last].compiled = command_compile(cmd);
 
     map->actions_last++;
+
+    if (map->index_size != map->actions_size * 2)
+        keymap_reindex(map);
+    else
+        keymap_index_insert(map, map->actions_last - 1);
 }
 
 static void replace_keybinding(rp_action *key_action, char *newcmd)
 {
     free(key_action->data);
+    command_compiled_free(key_action->compiled);
     key_action->data = xstrdup(newcmd);
+    key_action->compiled = command_compile(newcmd);
 }
 
 static int
 remove_keybinding(KeySym keysym, unsigned int state, rp_keymap *map)
 {
-    int i;
-    int found = -1;
-
-    for (i = 0; i < map->actions_last; i++) {
-        if (map->actions[i].key == keysym &&
-            map->actions[i].state == state) {
-            found = i;
-            break;
-        }
-    }
+    rp_action *action;
+    int found;
 
-    if (found >= 0) {
+    if ((action = find_keybinding(keysym, state, map))) {
+        found = action - map->actions;
         free(map->actions[found].data);
+        command_compiled_free(map->actions[found].compiled);
 
         memmove(&map->actions[found], &map->actions[found + 1],
                 sizeof(rp_action) * (map->actions_last - found - 1));
         map->actions_last--;
 
+        /* Every index after found has shifted down by one. */
+        keymap_reindex(map);
+
         return 1;
     }
 
@@ -737,6 +990,9 @@ static rp_keymap *keymap_new(char *name)
     map->actions_size = 1;
     map->actions = xmalloc(sizeof(rp_action) * map->actions_size);
     map->actions_last = 0;
+    map->index = NULL;
+    map->index_size = 0;
+    keymap_reindex(map);
 
     return map;
 }
@@ -755,26 +1011,41 @@ rp_keymap *find_keymap(char *name)
 }
 
 /*
- * Search the alias table for a match. If a match is found, return its index
- * into the table. Otherwise return -1.
+ * Bisect the alias table for the first len characters of name. If a match is
+ * found, return its index into the table. Otherwise return -1 and, if pos is
+ * not NULL, store the index it would have to be inserted at.
  */
-static int find_alias_index(char *name)
+static int find_alias_index_n(const char *name, size_t len, int *pos)
 {
-    int i;
+    int lo = 0, hi = alias_list_last - 1, mid, c;
 
-    for (i = 0; i < alias_list_last; i++)
-        if (!strcmp(name, alias_list[i].name))
-            return i;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = name_cmp(alias_list[mid].name, name, len);
+        if (c == 0)
+            return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
 
+    if (pos)
+        *pos = lo;
     return -1;
 }
 
+static int find_alias_index(char *name)
+{
+    return find_alias_index_n(name, strlen(name), NULL);
+}
+
 static void add_alias(char *name, char *alias)
 {
-    int i;
+    int i, pos;
 
     /* Are we updating an existing alias, or creating a new one? */
-    i = find_alias_index(name);
+    i = find_alias_index_n(name, strlen(name), &pos);
     if (i >= 0) {
         free(alias_list[i].alias);
         alias_list[i].alias = xstrdup(alias);
@@ -784,10 +1055,16 @@ static void add_alias(char *name, char *alias)
             alias_list = xrealloc(alias_list,
                                   sizeof(alias_t) * alias_list_size);
         }
-        alias_list[alias_list_last].name = xstrdup(name);
-        alias_list[alias_list_last].alias = xstrdup(alias);
+        memmove(&alias_list[pos + 1], &alias_list[pos],
+                sizeof(alias_t) * (alias_list_last - pos));
+        alias_list[pos].name = xstrdup(name);
+        alias_list[pos].alias = xstrdup(alias);
         alias_list_last++;
     }
+
+    /* A cached string may now name this alias instead of a command. */
+    arg_cache_flush();
+    alias_generation++;
 }
 
 void initialize_default_keybindings(void)
@@ -872,10 +1149,12 @@ static void keymap_free(rp_keymap *map)
     /* Free the data in the actions. */
     for (i = 0; i < map->actions_last; i++) {
         free(map->actions[i].data);
+        command_compiled_free(map->actions[i].compiled);
     }
 
     /* Free the map data. */
     free(map->actions);
+    free(map->index);
     free(map->name);
 
     /* ...and the map itself. */
@@ -921,6 +1200,11 @@ void free_user_commands(void)
         list_del(&var->node);
         set_var_free(var);
     }
+
+    arg_cache_flush();
+    free(command_table);
+    command_table = NULL;
+    command_table_size = 0;
 }
 
 /*
@@ -1378,6 +1662,7 @@ cmdret *cmd_rename(int interactive, struct cmdarg **args)
     free(current_window()->user_name);
     current_window()->user_name = xstrdup(ARG_STRING(0));
     current_window()->named = 1;
+    format_invalidate(current_window());
     hook_run(&rp_title_changed_hook);
 
     /* Update the program bar. */
@@ -1456,18 +1741,137 @@ static int frame_selector_match(char ch)
     return -1;
 }
 
+/*
+ * Temporaries made while running a command come from a scratch arena that
+ * lasts as long as the outermost command() or command_run() call. Nested
+ * calls, from aliases or from commands that run other commands, share it and
+ * the whole thing is reset when the outermost call returns. The first chunk
+ * is kept around, so running a command normally costs no allocations for
+ * parsing. Anything that outlives the call, such as the cmdret or the
+ * arguments of a compiled command, is allocated normally.
+ */
+#define SCRATCH_CHUNK 4096
+#define SCRATCH_ALIGN (2 * sizeof(void *))
+#define SCRATCH_ROUND(n) (((n) + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1))
+
+struct scratch_chunk {
+    struct scratch_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+/* The newest chunk. The others follow it. */
+static struct scratch_chunk *scratch;
+static int scratch_depth;
+
+/* Set while reading arguments that have to stay on the heap. */
+static int scratch_bypass;
+
+static void scratch_enter(void)
+{
+    scratch_depth++;
+}
+
+static void scratch_leave(void)
+{
+    struct scratch_chunk *next;
+
+    if (--scratch_depth > 0 || scratch == NULL)
+        return;
+
+    while (scratch->next) {
+        next = scratch->next;
+        free(scratch);
+        scratch = next;
+    }
+    scratch->used = 0;
+}
+
+/* Only valid between scratch_enter() and scratch_leave(). */
+static void *scratch_alloc(size_t size)
+{
+    struct scratch_chunk *c;
+    size_t n;
+
+    size = SCRATCH_ROUND(size);
+    if (scratch == NULL || scratch->used + size > scratch->size) {
+        n = size > SCRATCH_CHUNK ? size : SCRATCH_CHUNK;
+        c = xmalloc(SCRATCH_ROUND(sizeof(struct scratch_chunk)) + n);
+        c->next = scratch;
+        c->size = n;
+        c->used = 0;
+        scratch = c;
+    }
+
+    c = scratch;
+    c->used += size;
+    return (char *) c + SCRATCH_ROUND(sizeof(struct scratch_chunk))
+        + c->used - size;
+}
+
+static char *scratch_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+
+    return memcpy(scratch_alloc(len), str, len);
+}
+
+/* Return non-zero if args read now should come from the arena. */
+static int arg_scratch(void)
+{
+    return scratch_depth > 0 && !scratch_bypass;
+}
+
+static void *arg_alloc(size_t size)
+{
+    return arg_scratch() ? scratch_alloc(size) : xmalloc(size);
+}
+
+/* Free something arg_alloc() or one of its friends returned. */
+static void arg_release(void *p)
+{
+    if (!arg_scratch())
+        free(p);
+}
+
+static char *arg_strdup(const char *str)
+{
+    return arg_scratch() ? scratch_strdup(str) : xstrdup(str);
+}
+
+/* Take over a string get_input() returned. */
+static char *arg_adopt(char *str)
+{
+    char *copy;
+
+    if (str == NULL || !arg_scratch())
+        return str;
+
+    copy = scratch_strdup(str);
+    free(str);
+    return copy;
+}
+
+static struct cmdarg *arg_new(void)
+{
+    struct cmdarg *arg = arg_alloc(sizeof(struct cmdarg));
+
+    arg->scratch = arg_scratch();
+    return arg;
+}
+
 static cmdret *read_string(struct argspec *spec, struct sbuf *s,
                            completion_fn fn, struct cmdarg **arg)
 {
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, fn);
+        input = arg_adopt(get_input(spec->prompt, fn));
 
     if (input) {
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = spec->type;
         (*arg)->string = input;
         return NULL;
@@ -1483,9 +1887,9 @@ static cmdret *read_keymap(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, keymap_completions);
+        input = arg_adopt(get_input(spec->prompt, keymap_completions));
 
     if (input) {
         rp_keymap *map;
@@ -1494,11 +1898,11 @@ static cmdret *read_keymap(struct argspec *spec, struct sbuf *s,
         if (map == NULL) {
             cmdret *ret = cmdret_new(RET_FAILURE,
                                      "unknown keymap '%s'", input);
-            free(input);
+            arg_release(input);
             return ret;
         }
 
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = spec->type;
         (*arg)->arg.keymap = map;
         (*arg)->string = input;
@@ -1516,21 +1920,22 @@ static cmdret *read_keydesc(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, trivial_completions);
+        input = arg_adopt(get_input(spec->prompt, trivial_completions));
 
     if (input) {
         cmdret *ret;
-        struct rp_key *key = xmalloc(sizeof(struct rp_key));
+        struct rp_key *key = arg_alloc(sizeof(struct rp_key));
 
         ret = parse_keydesc(input, key);
         if (ret) {
-            free(key);
+            arg_release(key);
+            arg_release(input);
             return ret;
         }
 
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = spec->type;
         (*arg)->arg.key = key;
         (*arg)->string = input;
@@ -1747,7 +2152,7 @@ static cmdret *read_frame(struct sbuf *s, struct cmdarg **arg)
         XSync(dpy, False);
 
         /* Read a key. */
-        read_single_key(&c, &mod, keysym_buf, keysym_bufsize);
+        read_single_key(&c, &mod, keysym_buf, keysym_bufsize, 0);
 
         /* Destroy our number windows and free the array. */
         for (i = 0; i < frames; i++)
@@ -1796,7 +2201,7 @@ static cmdret *read_frame(struct sbuf *s, struct cmdarg **arg)
          * strings. Sucky, yes. The command is simply going to parse
          * it back into an rp_frame.
          */
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = arg_FRAME;
         (*arg)->string = NULL;
         (*arg)->arg.frame = frame;
@@ -1813,9 +2218,9 @@ static cmdret *read_window(struct argspec *spec, struct sbuf *s,
     char *name;
 
     if (s)
-        name = xstrdup(sbuf_get(s));
+        name = arg_strdup(sbuf_get(s));
     else
-        name = get_input(spec->prompt, window_completions);
+        name = arg_adopt(get_input(spec->prompt, window_completions));
 
     if (name) {
         /* try by name */
@@ -1824,14 +2229,14 @@ static cmdret *read_window(struct argspec *spec, struct sbuf *s,
             win = find_window_name(name, 0);
 
         if (win) {
-            *arg = xmalloc(sizeof(struct cmdarg));
+            *arg = arg_new();
             (*arg)->type = arg_WINDOW;
             (*arg)->arg.win = win;
             (*arg)->string = name;
             return NULL;
         }
 
-        free(name);
+        arg_release(name);
         *arg = NULL;
         return cmdret_new(RET_SUCCESS, NULL);
     }
@@ -1882,9 +2287,9 @@ static cmdret *read_gravity(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, trivial_completions);
+        input = arg_adopt(get_input(spec->prompt, trivial_completions));
 
     if (input) {
         int g = parse_wingravity(input);
@@ -1892,11 +2297,11 @@ static cmdret *read_gravity(struct argspec *spec, struct sbuf *s,
         if (g == -1) {
             cmdret *ret = cmdret_new(RET_FAILURE,
                                      "bad gravity '%s'", input);
-            free(input);
+            arg_release(input);
             return ret;
         }
 
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = arg_GRAVITY;
         (*arg)->arg.gravity = g;
         (*arg)->string = input;
@@ -1940,14 +2345,14 @@ static cmdret *read_vscreen(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, vscreen_completions);
+        input = arg_adopt(get_input(spec->prompt, vscreen_completions));
 
     if (input) {
         rp_vscreen *v = find_vscreen(input);
         if (v) {
-            *arg = xmalloc(sizeof(struct cmdarg));
+            *arg = arg_new();
             (*arg)->type = arg_VSCREEN;
             (*arg)->arg.vscreen = v;
             (*arg)->string = input;
@@ -1956,7 +2361,7 @@ static cmdret *read_vscreen(struct argspec *spec, struct sbuf *s,
 
         cmdret *ret = cmdret_new(RET_FAILURE, "unknown vscreen '%s'",
                                  input);
-        free(input);
+        arg_release(input);
         return ret;
     }
 
@@ -1990,15 +2395,15 @@ static cmdret *read_hook(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, hook_completions);
+        input = arg_adopt(get_input(spec->prompt, hook_completions));
 
     if (input) {
         struct list_head *hook = hook_lookup(input);
 
         if (hook) {
-            *arg = xmalloc(sizeof(struct cmdarg));
+            *arg = arg_new();
             (*arg)->type = arg_HOOK;
             (*arg)->arg.hook = hook;
             (*arg)->string = input;
@@ -2007,7 +2412,7 @@ static cmdret *read_hook(struct argspec *spec, struct sbuf *s,
 
         cmdret *ret = cmdret_new(RET_FAILURE, "unknown hook '%s'",
                                  input);
-        free(input);
+        arg_release(input);
         return ret;
     }
 
@@ -2054,9 +2459,9 @@ static cmdret *read_variable(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, var_completions);
+        input = arg_adopt(get_input(spec->prompt, var_completions));
 
     if (input) {
         struct set_var *var = find_variable(input);
@@ -2064,11 +2469,11 @@ static cmdret *read_variable(struct argspec *spec, struct sbuf *s,
         if (var == NULL) {
             cmdret *ret = cmdret_new(RET_FAILURE,
                                      "unknown variable '%s'", input);
-            free(input);
+            arg_release(input);
             return ret;
         }
 
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = arg_VARIABLE;
         (*arg)->arg.variable = var;
         (*arg)->string = input;
@@ -2086,9 +2491,9 @@ static cmdret *read_number(struct argspec *spec, struct sbuf *s,
     char *input;
 
     if (s)
-        input = xstrdup(sbuf_get(s));
+        input = arg_strdup(sbuf_get(s));
     else
-        input = get_input(spec->prompt, trivial_completions);
+        input = arg_adopt(get_input(spec->prompt, trivial_completions));
 
     if (input) {
         char *ep;
@@ -2103,7 +2508,7 @@ static cmdret *read_number(struct argspec *spec, struct sbuf *s,
             return cmdret_new(RET_FAILURE, "out of range number `%s'",
                               input);
 
-        *arg = xmalloc(sizeof(struct cmdarg));
+        *arg = arg_new();
         (*arg)->type = arg_NUMBER;
         (*arg)->arg.number = lval;
         (*arg)->string = input;
@@ -2246,7 +2651,8 @@ static cmdret *parse_args(char *str, struct list_head *list, int nargs,
     if (str == NULL)
         return NULL;
 
-    tmp = xmalloc(strlen(str) + 1);
+    scratch_enter();
+    tmp = scratch_alloc(strlen(str) + 1);
 
     for (i = str; *i; i++) {
         /* Have we hit the arg limit? */
@@ -2321,17 +2727,20 @@ static cmdret *parse_args(char *str, struct list_head *list, int nargs,
         list_add_tail(&s->node, list);
     }
 
-    free(tmp);
+    scratch_leave();
     return ret;
 }
 
-/* Convert the list to an array, for easier access in commands. */
+/*
+ * Convert the list to an array, for easier access in commands. It comes from
+ * the scratch arena.
+ */
 static struct cmdarg **arg_array(struct list_head *head)
 {
     int i = 0;
     struct cmdarg **args, *cur;
 
-    args = xmalloc(sizeof(struct cmdarg *) * (list_size(head) + 1));
+    args = scratch_alloc(sizeof(struct cmdarg *) * (list_size(head) + 1));
     list_for_each_entry(cur, head, node) {
         args[i] = cur;
         i++;
@@ -2344,7 +2753,7 @@ static struct cmdarg **arg_array(struct list_head *head)
 
 static void arg_free(struct cmdarg *arg)
 {
-    if (!arg)
+    if (!arg || arg->scratch)
         return;
 
     /* read_frame doesn't fill in string. */
@@ -2377,55 +2786,163 @@ static void arg_free(struct cmdarg *arg)
     free(arg);
 }
 
-cmdret *command(int interactive, char *data)
+/*
+ * Skip leading whitespace and return the command name at the start of data.
+ * Its length goes in len and rest points at its arguments.
+ */
+static char *split_command(char *data, size_t *len, char **rest)
+{
+    char *cmd = data;
+
+    while (*cmd && isspace((unsigned char) *cmd))
+        cmd++;
+    *rest = cmd;
+    while (**rest && !isspace((unsigned char) **rest))
+        (*rest)++;
+    *len = *rest - cmd;
+    if (**rest)
+        (*rest)++;
+
+    return cmd;
+}
+
+/* Tokenize the arguments in rest as uc expects them. */
+static cmdret *parse_command_args(struct user_command *uc, char *rest,
+                                  struct list_head *head)
+{
+    int i, nargs = 0, raw = 0;
+
+    /* We need to tell parse_args about arg_REST and arg_SHELLCMD. */
+    for (i = 0; i < uc->num_args; i++)
+        if (uc->args[i].type == arg_REST ||
+            uc->args[i].type == arg_COMMAND ||
+            uc->args[i].type == arg_SHELLCMD ||
+            uc->args[i].type == arg_RAW) {
+            raw = 1;
+            nargs = i;
+            break;
+        }
+
+    return parse_args(rest, head, nargs, raw);
+}
+
+static void arg_cache_clear(struct arg_cache_entry *ce)
+{
+    struct sbuf *cur;
+    struct list_head *iter, *tmp;
+
+    list_for_each_safe_entry(cur, iter, tmp, &ce->tokens, node)
+        sbuf_free(cur);
+    free(ce->data);
+    ce->data = NULL;
+    ce->uc = NULL;
+}
+
+static void arg_cache_flush(void)
+{
+    int i;
+
+    for (i = 0; i < ARG_CACHE_SIZE; i++) {
+        if (arg_cache[i].data)
+            arg_cache_clear(&arg_cache[i]);
+    }
+}
+
+/* Return the cache slot data maps to. It may hold some other string. */
+static struct arg_cache_entry *arg_cache_slot(const char *data)
+{
+    unsigned long h = 2166136261UL;
+
+    for (; *data; data++)
+        h = (h ^ (unsigned char) *data) * 16777619UL;
+
+    return &arg_cache[h % ARG_CACHE_SIZE];
+}
+
+/* Turn the tokens into cmdargs and call the command. */
+static cmdret *run_user_command(int interactive, struct user_command *uc,
+                                struct list_head *head)
+{
+    cmdret *result;
+    struct cmdarg *acur;
+    struct list_head *iter, *tmp;
+    struct list_head args;
+    int ntokens;
+
+    INIT_LIST_HEAD(&args);
+
+    /*
+     * head may be a cache entry, which a nested command() could replace once
+     * the command runs. Count it before anything else gets the chance.
+     */
+    ntokens = list_size(head);
+
+    /* Interactive commands prompt the user for missing args. */
+    if (interactive)
+        result = fill_in_missing_args(uc, head, &args, uc->name);
+    else {
+        int parsed_args;
+        result = parsed_input_to_args(uc->num_args, uc->args, head, &args,
+                                      &parsed_args, uc->name);
+    }
+
+    if (result == NULL) {
+        if ((interactive && list_size(&args) < uc->i_required_args) ||
+            (!interactive && list_size(&args) < uc->ni_required_args)) {
+            result = cmdret_new(RET_FAILURE, "not enough arguments.");
+        } else if (ntokens > uc->num_args) {
+            result = cmdret_new(RET_FAILURE, "command: too many arguments.");
+        } else {
+            result = uc->func(interactive, arg_array(&args));
+        }
+    }
+
+    /* Free the args */
+    list_for_each_safe_entry(acur, iter, tmp, &args, node)
+        arg_free(acur);
+
+    return result;
+}
+
+static cmdret *run_command(int interactive, char *data)
 {
     /* This static counter is used to exit from recursive alias calls. */
     static int alias_recursive_depth = 0;
     cmdret *result = NULL;
-    char *cmd, *rest;
-    char *input;
+    struct arg_cache_entry *ce;
     struct user_command *uc;
+    struct sbuf *s;
+    struct list_head head;
+    char *cmd, *rest, *str;
+    size_t len;
     int i;
 
     if (data == NULL)
         return cmdret_new(RET_FAILURE, NULL);
 
-    /* get a writable copy for strtok() */
-    input = xstrdup(data);
+    /* Strings we have already run skip straight to the command. */
+    ce = arg_cache_slot(data);
+    if (ce->data && !strcmp(ce->data, data))
+        return run_user_command(interactive, ce->uc, &ce->tokens);
 
-    cmd = input;
-    /* skip beginning whitespace. */
-    while (*cmd && isspace((unsigned char) *cmd))
-        cmd++;
-    rest = cmd;
-    /* skip til we get to whitespace */
-    while (*rest && !isspace((unsigned char) *rest))
-        rest++;
-    /*
-     * mark that spot as the end of the command and make rest point to the
-     * rest of the string.
-     */
-    if (*rest) {
-        *rest = 0;
-        rest++;
-    }
-    PRINT_DEBUG(("cmd==%s rest==%s\n", cmd, rest ? rest : "NULL"));
+    cmd = split_command(data, &len, &rest);
+    PRINT_DEBUG(("cmd==%.*s rest==%s\n", (int) len, cmd, rest));
 
     /* Look for it in the aliases, first. */
-    for (i = 0; i < alias_list_last; i++) {
-        if (strcmp(cmd, alias_list[i].name) != 0)
-            continue;
-
-        struct sbuf *s;
-
+    if ((i = find_alias_index_n(cmd, len, NULL)) >= 0) {
         /*
          * Append any arguments onto the end of the alias'
          * command.
          */
-        s = sbuf_new(0);
-        sbuf_concat(s, alias_list[i].alias);
-        if (rest != NULL && *rest)
-            sbuf_printf_concat(s, " %s", rest);
+        len = strlen(alias_list[i].alias);
+        str = scratch_alloc(len + strlen(rest) + 2);
+        memcpy(str, alias_list[i].alias, len);
+        if (*rest) {
+            str[len++] = ' ';
+            strcpy(str + len, rest);
+        } else {
+            str[len] = '\0';
+        }
 
         alias_recursive_depth++;
         if (alias_recursive_depth >= MAX_ALIAS_RECURSIVE_DEPTH)
@@ -2433,88 +2950,251 @@ cmdret *command(int interactive, char *data)
                                 "command: alias recursion has exceeded "
                                 "maximum depth");
         else
-            result = command(interactive, sbuf_get(s));
+            result = run_command(interactive, str);
         alias_recursive_depth--;
 
-        sbuf_free(s);
-        goto done;
+        return result;
     }
 
     /* If it wasn't an alias, maybe its a command. */
-    list_for_each_entry(uc, &user_commands, node) {
-        if (strcmp(cmd, uc->name) != 0)
-            continue;
+    if ((uc = find_user_command(cmd, len)) == NULL) {
+        str = scratch_alloc(len + 1);
+        memcpy(str, cmd, len);
+        str[len] = '\0';
+        return cmdret_new(RET_FAILURE, MESSAGE_UNKNOWN_COMMAND, str);
+    }
 
-        struct sbuf *scur;
-        struct cmdarg *acur;
+    INIT_LIST_HEAD(&head);
+    result = parse_command_args(uc, rest, &head);
+    if (result) {
         struct list_head *iter, *tmp;
-        struct list_head head, args;
-        int nargs = 0, raw = 0;
 
-        INIT_LIST_HEAD(&args);
-        INIT_LIST_HEAD(&head);
+        list_for_each_safe_entry(s, iter, tmp, &head, node)
+            sbuf_free(s);
+        return result;
+    }
 
-        /*
-         * We need to tell parse_args about arg_REST and
-         * arg_SHELLCMD.
-         */
-        for (i = 0; i < uc->num_args; i++)
-            if (uc->args[i].type == arg_REST ||
-                uc->args[i].type == arg_COMMAND ||
-                uc->args[i].type == arg_SHELLCMD ||
-                uc->args[i].type == arg_RAW) {
-                raw = 1;
-                nargs = i;
-                break;
-            }
+    /* Keep the tokens for next time, evicting whatever was there. */
+    if (ce->data)
+        arg_cache_clear(ce);
+    ce->data = xstrdup(data);
+    ce->uc = uc;
+    INIT_LIST_HEAD(&ce->tokens);
+    list_splice_init(&head, &ce->tokens);
 
-        /* Parse the arguments and call the function. */
-        result = parse_args(rest, &head, nargs, raw);
-        if (result)
-            goto free_lists;
+    return run_user_command(interactive, uc, &ce->tokens);
+}
 
-        /* Interactive commands prompt the user for missing args. */
-        if (interactive)
-            result = fill_in_missing_args(uc, &head, &args, uc->name);
-        else {
-            int parsed_args;
-            result = parsed_input_to_args(uc->num_args,
-                                          uc->args, &head, &args,
-                                          &parsed_args, uc->name);
-        }
+cmdret *command(int interactive, char *data)
+{
+    cmdret *result;
 
-        if (result == NULL) {
-            if ((interactive && list_size(&args) < uc->i_required_args) ||
-                (!interactive
-                 && list_size(&args) < uc->ni_required_args)) {
-                result = cmdret_new(RET_FAILURE, "not enough arguments.");
-                goto free_lists;
-            } else if (list_size(&head) > uc->num_args) {
-                result = cmdret_new(RET_FAILURE,
-                                    "command: too many arguments.");
-                goto free_lists;
-            } else {
-                struct cmdarg **cmdargs = arg_array(&args);
-                result = uc->func(interactive, cmdargs);
-                free(cmdargs);
+    scratch_enter();
+    result = run_command(interactive, data);
+    scratch_leave();
+
+    return result;
+}
+
+/* Return 0 if an argument of this type has to be read each time it's used. */
+static int arg_is_constant(int type)
+{
+    switch (type) {
+    case arg_FRAME:
+    case arg_KEYMAP:
+    case arg_VSCREEN:
+    case arg_WINDOW:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+static void compiled_args_free(rp_compiled_cmd *cc)
+{
+    int i;
+
+    for (i = 0; i < cc->nargs; i++) {
+        arg_free(cc->args[i]);
+        sbuf_free(cc->deferred[i]);
+    }
+    free(cc->args);
+    free(cc->deferred);
+    cc->args = NULL;
+    cc->deferred = NULL;
+    cc->nargs = 0;
+}
+
+/*
+ * Resolve data to its command and convert its arguments now, so running it
+ * later does not have to. Strings naming an alias or that fail to parse are
+ * still returned, and command_run() hands them to command() as they are.
+ */
+rp_compiled_cmd *command_compile(char *data)
+{
+    rp_compiled_cmd *cc;
+    struct user_command *uc;
+    struct list_head head;
+    struct list_head *iter, *tmp;
+    struct sbuf *cur;
+    cmdret *ret;
+    char *cmd, *rest;
+    size_t len;
+    int i = 0, failed = 0;
+
+    cc = xmalloc(sizeof(rp_compiled_cmd));
+    cc->data = xstrdup(data);
+    cc->uc = NULL;
+    cc->alias_generation = alias_generation;
+    cc->nargs = 0;
+    cc->args = NULL;
+    cc->deferred = NULL;
+    cc->constant = 1;
+    cc->refs = 1;
+
+    cmd = split_command(cc->data, &len, &rest);
+    if (find_alias_index_n(cmd, len, NULL) >= 0 ||
+        (uc = find_user_command(cmd, len)) == NULL)
+        return cc;
+
+    INIT_LIST_HEAD(&head);
+    if ((ret = parse_command_args(uc, rest, &head))) {
+        cmdret_free(ret);
+        failed = 1;
+    } else if (list_size(&head) > uc->num_args) {
+        failed = 1;
+    } else {
+        cc->nargs = list_size(&head);
+        cc->args = xmalloc(sizeof(struct cmdarg *) * (cc->nargs + 1));
+        cc->deferred = xmalloc(sizeof(struct sbuf *) * (cc->nargs + 1));
+    }
+
+    list_for_each_safe_entry(cur, iter, tmp, &head, node) {
+        if (failed || i >= cc->nargs)
+            break;
+
+        cc->args[i] = NULL;
+        cc->deferred[i] = NULL;
+        if (arg_is_constant(uc->args[i].type)) {
+            /* These are kept for as long as the compiled command. */
+            scratch_bypass++;
+            ret = read_arg(&uc->args[i], cur, &cc->args[i], uc->name);
+            scratch_bypass--;
+            if (ret) {
+                cmdret_free(ret);
+                cc->args[i] = NULL;
+                failed = 1;
             }
+        } else {
+            list_del(&cur->node);
+            cc->deferred[i] = cur;
+            cc->constant = 0;
         }
-      free_lists:
-        /* Free the parsed strings */
-        list_for_each_safe_entry(scur, iter, tmp, &head, node)
-            sbuf_free(scur);
+        i++;
+    }
+    list_for_each_safe_entry(cur, iter, tmp, &head, node)
+        sbuf_free(cur);
+
+    if (failed) {
+        /* Let command() report the problem when it's run. */
+        for (; i < cc->nargs; i++) {
+            cc->args[i] = NULL;
+            cc->deferred[i] = NULL;
+        }
+        compiled_args_free(cc);
+        return cc;
+    }
+
+    cc->args[cc->nargs] = NULL;
+    cc->uc = uc;
+    return cc;
+}
+
+void command_compiled_free(rp_compiled_cmd *cc)
+{
+    if (cc == NULL || --cc->refs > 0)
+        return;
+
+    compiled_args_free(cc);
+    free(cc->data);
+    free(cc);
+}
+
+static cmdret *run_compiled(int interactive, rp_compiled_cmd *cc)
+{
+    struct user_command *uc = cc->uc;
+    struct cmdarg **argv;
+    cmdret *result = NULL;
+    char *cmd, *rest;
+    size_t len;
+    int i, n = 0, required;
+
+    /* An alias defined since compiling takes precedence. */
+    if (uc && cc->alias_generation != alias_generation) {
+        cmd = split_command(cc->data, &len, &rest);
+        if (find_alias_index_n(cmd, len, NULL) >= 0)
+            uc = NULL;
+        else
+            cc->alias_generation = alias_generation;
+    }
 
-        /* Free the args */
-        list_for_each_safe_entry(acur, iter, tmp, &args, node)
-            arg_free(acur);
+    if (uc == NULL)
+        return run_command(interactive, cc->data);
 
-        goto done;
+    required = interactive ? uc->i_required_args : uc->ni_required_args;
+    cc->refs++;
+
+    /* Nothing to read or prompt for, so use the arguments as they are. */
+    if (cc->constant && cc->nargs >= required) {
+        result = uc->func(interactive, cc->args);
+        command_compiled_free(cc);
+        return result;
     }
 
-    result = cmdret_new(RET_FAILURE, MESSAGE_UNKNOWN_COMMAND, cmd);
+    argv = scratch_alloc(sizeof(struct cmdarg *) * (uc->num_args + 1));
+
+    for (i = 0; i < cc->nargs; i++, n++) {
+        if (cc->args[i])
+            argv[i] = cc->args[i];
+        else if ((result = read_arg(&uc->args[i], cc->deferred[i],
+                                    &argv[i], uc->name)))
+            goto done;
+    }
+
+    /* Interactive commands prompt the user for missing args. */
+    if (interactive) {
+        for (; i < uc->i_required_args; i++, n++) {
+            if ((result = read_arg(&uc->args[i], NULL, &argv[i], uc->name)))
+                goto done;
+        }
+    }
+    argv[n] = NULL;
+
+    if (n < required)
+        result = cmdret_new(RET_FAILURE, "not enough arguments.");
+    else
+        result = uc->func(interactive, argv);
 
   done:
-    free(input);
+    /* Only free what was read for this run. */
+    for (i = 0; i < n; i++) {
+        if (i >= cc->nargs || cc->args[i] == NULL)
+            arg_free(argv[i]);
+    }
+    command_compiled_free(cc);
+
+    return result;
+}
+
+/* Run a command compiled by command_compile(). */
+cmdret *command_run(int interactive, rp_compiled_cmd *cc)
+{
+    cmdret *result;
+
+    scratch_enter();
+    result = run_compiled(interactive, cc);
+    scratch_leave();
+
     return result;
 }
 
@@ -2822,7 +3502,7 @@ cmdret *cmd_windowselector(int interactive, struct cmdarg **args)
 
     /* Interactive selection loop */
     while (!done) {
-        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf));
+        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf), 0);
         modifier = x11_mask_to_rp_mask(modifier);
 
         switch (ch) {
@@ -3167,7 +3847,7 @@ cmdret *cmd_applauncher(int interactive, struct cmdarg **args)
 
     /* Interactive selection loop */
     while (!done) {
-        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf));
+        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf), 0);
         modifier = x11_mask_to_rp_mask(modifier);
 
         switch (ch) {
@@ -3271,6 +3951,9 @@ cmdret *cmd_escape(int interactive, struct cmdarg **args)
             action->state = RP_CONTROL_MASK;
     }
 
+    /* The bindings moved to other keys, so they hash elsewhere. */
+    keymap_reindex(map);
+
     /* Remove the grab on the current prefix key */
     ungrab_keys_all_wins();
 
@@ -3278,6 +3961,7 @@ cmdret *cmd_escape(int interactive, struct cmdarg **args)
     if (action != NULL && !strcmp(action->data, "readkey " ROOT_KEYMAP)) {
         action->key = key->sym;
         action->state = key->state;
+        keymap_reindex(top);
     }
 
     /* Add the grab for the new prefix key */
@@ -3480,7 +4164,7 @@ cmdret *cmd_resize(int interactive, struct cmdarg **args)
             struct resize_binding *binding;
 
             show_frame_message(defaults.resize_fmt);
-            read_key(&c, &mod, buffer, sizeof(buffer));
+            read_key(&c, &mod, buffer, sizeof(buffer), 0);
 
             /* Convert the mask to be compatible with us. */
             mod = x11_mask_to_rp_mask(mod);
@@ -4003,6 +4687,8 @@ static void update_gc(rp_screen *s)
     s->inverse_gc = XCreateGC(dpy, s->root,
                               GCForeground | GCBackground | GCFunction |
                               GCLineWidth | GCSubwindowMode, &gcv);
+
+    invalidate_bar(s);
 }
 
 static cmdret *set_font(struct cmdarg **args)
@@ -4020,8 +4706,10 @@ static cmdret *set_font(struct cmdarg **args)
         if (font == NULL)
             return cmdret_new(RET_FAILURE, "set font: unknown font");
 
+        flush_glyph_cache(s);
         XftFontClose(dpy, s->xft_font);
         s->xft_font = font;
+        invalidate_bar(s);
     }
 
     free(defaults.font_string);
@@ -4201,6 +4889,7 @@ static cmdret *set_infofmt(struct cmdarg **args)
 
     free(defaults.info_fmt);
     defaults.info_fmt = xstrdup(ARG_STRING(0));
+    format_compile(defaults.info_fmt);
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -4231,6 +4920,7 @@ static cmdret *set_winfmt(struct cmdarg **args)
 
     free(defaults.window_fmt);
     defaults.window_fmt = xstrdup(ARG_STRING(0));
+    format_compile(defaults.window_fmt);
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -4264,6 +4954,8 @@ static cmdret *set_winname(struct cmdarg **args)
         return cmdret_new(RET_FAILURE,
                           "set winname: invalid argument `%s'", name);
 
+    format_invalidate_all();
+
     return cmdret_new(RET_SUCCESS, NULL);
 }
 
@@ -4274,6 +4966,7 @@ static cmdret *set_framefmt(struct cmdarg **args)
 
     free(defaults.frame_fmt);
     defaults.frame_fmt = xstrdup(ARG_STRING(0));
+    format_compile(defaults.frame_fmt);
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -4492,6 +5185,26 @@ static cmdret *set_resizefmt(struct cmdarg **args)
 
     free(defaults.resize_fmt);
     defaults.resize_fmt = xstrdup(ARG_STRING(0));
+    format_compile(defaults.resize_fmt);
+
+    return cmdret_new(RET_SUCCESS, NULL);
+}
+
+static cmdret *set_rootkeygrab(struct cmdarg **args)
+{
+    if (args[0] == NULL)
+        return cmdret_new(RET_SUCCESS, "%d", defaults.root_key_grab);
+
+    if (ARG(0, number) < 0 || ARG(0, number) > 1)
+        return cmdret_new(RET_FAILURE, "rootkeygrab: invalid argument");
+
+    if (ARG(0, number) == defaults.root_key_grab)
+        return cmdret_new(RET_SUCCESS, NULL);
+
+    /* Drop the grabs made in the old mode before switching. */
+    ungrab_keys_all_wins();
+    defaults.root_key_grab = ARG(0, number);
+    grab_keys_all_wins();
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -4795,32 +5508,22 @@ cmdret *cmd_alias(int interactive, struct cmdarg **args)
 
 cmdret *cmd_unalias(int interactive, struct cmdarg **args)
 {
-    char *tmp;
     int i;
 
-    /* Are we updating an existing alias, or creating a new one? */
     i = find_alias_index(ARG_STRING(0));
     if (i < 0)
         return cmdret_new(RET_SUCCESS, "unalias: alias not found");
 
-    alias_list_last--;
+    free(alias_list[i].name);
+    free(alias_list[i].alias);
 
-    /*
-     * Free the alias and put the last alias in the the space to
-     * keep alias_list from becoming sparse. This code must jump
-     * through some hoops to correctly handle the case when
-     * alias_list_last == i.
-     */
-    tmp = alias_list[i].alias;
-    alias_list[i].alias = xstrdup(alias_list[alias_list_last].alias);
-    free(tmp);
-    free(alias_list[alias_list_last].alias);
+    /* Close the gap, keeping the table sorted. */
+    alias_list_last--;
+    memmove(&alias_list[i], &alias_list[i + 1],
+            sizeof(alias_t) * (alias_list_last - i));
 
-    /* Do the same for the name element. */
-    tmp = alias_list[i].name;
-    alias_list[i].name = xstrdup(alias_list[alias_list_last].name);
-    free(tmp);
-    free(alias_list[alias_list_last].name);
+    arg_cache_flush();
+    alias_generation++;
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -4991,38 +5694,12 @@ cmdret *cmd_fdump(int interactively, struct cmdarg **args)
     return ret;
 }
 
-cmdret *frestore(char *data, rp_vscreen *v)
+/* Replace the frames of v with the ones in fset. */
+static cmdret *frestore_frames(rp_vscreen *v, struct list_head *fset)
 {
-    char *token;
-    char *d;
-    rp_frame *new, *cur;
+    rp_frame *cur;
     rp_window *win;
-    struct list_head fset;
     int max = -1;
-    char *nexttok = NULL;
-
-    INIT_LIST_HEAD(&fset);
-
-    d = xstrdup(data);
-    token = strtok_r(d, ",", &nexttok);
-    if (token == NULL) {
-        free(d);
-        return cmdret_new(RET_FAILURE, "frestore: invalid frame format");
-    }
-
-    /* Build the new frame set. */
-    while (token != NULL) {
-        new = frame_read(token, v);
-        if (new == NULL) {
-            free(d);
-            return cmdret_new(RET_FAILURE,
-                              "frestore: invalid frame format");
-        }
-        list_add_tail(&new->node, &fset);
-        token = strtok_r(NULL, ",", &nexttok);
-    }
-
-    free(d);
 
     /* Clear all the frames. */
     list_for_each_entry(cur, &v->frames, node) {
@@ -5034,7 +5711,7 @@ cmdret *frestore(char *data, rp_vscreen *v)
     vscreen_free_nums(v);
 
     /* Splice in our new frameset. */
-    vscreen_restore_frameset(v, &fset);
+    vscreen_restore_frameset(v, fset);
 
     /* Process the frames a bit to make sure everything lines up. */
     list_for_each_entry(cur, &v->frames, node) {
@@ -5074,6 +5751,40 @@ cmdret *frestore(char *data, rp_vscreen *v)
     return cmdret_new(RET_SUCCESS, NULL);
 }
 
+cmdret *frestore(char *data, rp_vscreen *v)
+{
+    char *token;
+    char *d;
+    rp_frame *new;
+    struct list_head fset;
+    char *nexttok = NULL;
+
+    INIT_LIST_HEAD(&fset);
+
+    d = xstrdup(data);
+    token = strtok_r(d, ",", &nexttok);
+    if (token == NULL) {
+        free(d);
+        return cmdret_new(RET_FAILURE, "frestore: invalid frame format");
+    }
+
+    /* Build the new frame set. */
+    while (token != NULL) {
+        new = frame_read(token, v);
+        if (new == NULL) {
+            free(d);
+            return cmdret_new(RET_FAILURE,
+                              "frestore: invalid frame format");
+        }
+        list_add_tail(&new->node, &fset);
+        token = strtok_r(NULL, ",", &nexttok);
+    }
+
+    free(d);
+
+    return frestore_frames(v, &fset);
+}
+
 cmdret *cmd_frestore(int interactively, struct cmdarg **args)
 {
     push_frame_undo(rp_current_vscreen);        /* fdump to stack */
@@ -5107,7 +5818,6 @@ static cmdret *set_winliststyle(struct cmdarg **args)
 cmdret *cmd_addhook(int interactive, struct cmdarg **args)
 {
     struct list_head *hook;
-    struct sbuf *cmd;
 
     hook = hook_lookup(ARG_STRING(0));
     if (hook == NULL)
@@ -5115,22 +5825,15 @@ cmdret *cmd_addhook(int interactive, struct cmdarg **args)
                           ARG_STRING(0));
 
     /* Add the command to the hook */
-    cmd = sbuf_new(0);
-    sbuf_copy(cmd, ARG_STRING(1));
-    hook_add(hook, cmd);
+    hook_add(hook, ARG_STRING(1));
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
 
 cmdret *cmd_remhook(int interactive, struct cmdarg **args)
 {
-    struct sbuf *cmd;
-
     /* Remove the command from the hook */
-    cmd = sbuf_new(0);
-    sbuf_copy(cmd, ARG_STRING(1));
-    hook_remove(ARG(0, hook), cmd);
-    sbuf_free(cmd);
+    hook_remove(ARG(0, hook), ARG_STRING(1));
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -5140,7 +5843,7 @@ cmdret *cmd_listhook(int interactive, struct cmdarg **args)
     cmdret *ret;
     struct sbuf *buffer;
     struct list_head *hook;
-    struct sbuf *cur;
+    struct rp_hook_cmd *cur;
 
     hook = hook_lookup(ARG_STRING(0));
     if (hook == NULL)
@@ -5154,7 +5857,7 @@ cmdret *cmd_listhook(int interactive, struct cmdarg **args)
     buffer = sbuf_new(0);
 
     list_for_each_entry(cur, hook, node) {
-        sbuf_printf_concat(buffer, "%s", sbuf_get(cur));
+        sbuf_printf_concat(buffer, "%s", cur->cmd);
         if (cur->node.next != hook)
             sbuf_printf_concat(buffer, "\n");
     }
@@ -5184,14 +5887,16 @@ cmdret *cmd_readkey(int interactive, struct cmdarg **args)
         grab_rat();
         rat_grabbed = 1;
     }
-    read_single_key(&keysym, &mod, NULL, 0);
+    read_single_key(&keysym, &mod, NULL, 0, 1);
 
     if (rat_grabbed)
         ungrab_rat();
 
-    if ((key_action =
-         find_keybinding(keysym, x11_mask_to_rp_mask(mod), map))) {
-        return command(1, key_action->data);
+    key_action = find_keybinding(keysym, x11_mask_to_rp_mask(mod), map);
+    latency_mark(LAT_LOOKUP);
+    if (key_action) {
+        latency_mark(LAT_DISPATCH);
+        return command_run(1, key_action->compiled);
     }
 
     /* No key match, notify user. */
@@ -5324,7 +6029,6 @@ cmdret *cmd_set(int interactive, struct cmdarg **args)
 
     cmdargs = arg_array(&arglist);
     result = ARG(0, variable)->set_fn(cmdargs);
-    free(cmdargs);
 
     /* Free the lists. */
   failed:
@@ -5471,10 +6175,41 @@ cmdret *cmd_sdump(int interactive, struct cmdarg **args)
     return ret;
 }
 
-static cmdret *set_maxundos(struct cmdarg **args)
+/*
+ * Dump everything in one go. Given the generation of a snapshot the caller
+ * already has, only say whether it's still current.
+ */
+cmdret *cmd_snapshot(int interactive, struct cmdarg **args)
 {
-    rp_frame_undo *cur;
+    unsigned long have;
+    cmdret *ret;
+    char *ep;
 
+    /* Generations are unsigned long, more than a number argument holds. */
+    if (args[0]) {
+        errno = 0;
+        have = strtoul(ARG_STRING(0), &ep, 10);
+        if (!isdigit((unsigned char) ARG_STRING(0)[0]) || *ep != '\0'
+            || errno == ERANGE)
+            return cmdret_new(RET_FAILURE,
+                              "snapshot: malformed generation `%s'",
+                              ARG_STRING(0));
+        if (have == snapshot_generation())
+            return cmdret_new(RET_SUCCESS, "(unchanged :generation %lu)",
+                              snapshot_generation());
+    }
+
+    /*
+     * It can be big. snapshot_dump already copies it out of its cache, so
+     * take that copy instead of formatting another through cmdret_new.
+     */
+    ret = cmdret_new(RET_SUCCESS, NULL);
+    ret->output = snapshot_dump();
+    return ret;
+}
+
+static cmdret *set_maxundos(struct cmdarg **args)
+{
     if (args[0] == NULL)
         return cmdret_new(RET_SUCCESS, "%d", defaults.maxundos);
 
@@ -5485,11 +6220,8 @@ static cmdret *set_maxundos(struct cmdarg **args)
     defaults.maxundos = ARG(0, number);
 
     /* Delete any superfluous undos */
-    while (list_size(&rp_frame_undos) > defaults.maxundos) {
-        /* Delete the oldest node */
-        list_last(cur, &rp_frame_undos, node);
-        del_frame_undo(cur);
-    }
+    frame_history_resize(&rp_frame_undos, defaults.maxundos);
+    frame_history_resize(&rp_frame_redos, defaults.maxundos);
 
     return cmdret_new(RET_SUCCESS, NULL);
 }
@@ -5628,6 +6360,32 @@ cmdret *cmd_iother(int interactive, struct cmdarg **args)
     return cmdret_new(RET_SUCCESS, NULL);
 }
 
+/* Put back the layout in u, no parsing needed. */
+static cmdret *frame_undo_restore(rp_frame_undo *u)
+{
+    struct list_head fset;
+    rp_frame *f;
+    int i;
+
+    INIT_LIST_HEAD(&fset);
+
+    for (i = 0; i < u->nframes; i++) {
+        f = frame_make(u->vscreen);
+        f->number = u->frames[i].number;
+        f->x = u->frames[i].x;
+        f->y = u->frames[i].y;
+        f->width = u->frames[i].width;
+        f->height = u->frames[i].height;
+        f->last_access = u->frames[i].last_access;
+        f->dedicated = u->frames[i].dedicated;
+        frame_fit(f, u->screen_width, u->screen_height,
+                  u->frames[i].window);
+        list_add_tail(&f->node, &fset);
+    }
+
+    return frestore_frames(u->vscreen, &fset);
+}
+
 cmdret *cmd_undo(int interactive, struct cmdarg **args)
 {
     rp_frame_undo *cur;
@@ -5636,12 +6394,8 @@ cmdret *cmd_undo(int interactive, struct cmdarg **args)
     if (!cur)
         return cmdret_new(RET_FAILURE,
                           "No more undo information available");
-    else {
-        cmdret *ret;
 
-        ret = frestore(cur->frames, cur->vscreen);
-        return ret;
-    }
+    return frame_undo_restore(cur);
 }
 
 cmdret *cmd_redo(int interactive, struct cmdarg **args)
@@ -5655,7 +6409,7 @@ cmdret *cmd_redo(int interactive, struct cmdarg **args)
         return cmdret_new(RET_FAILURE,
                           "No more redo information available");
 
-    ret = frestore(cur->frames, cur->vscreen);
+    ret = frame_undo_restore(cur);
     return ret;
 }
 
@@ -5714,7 +6468,7 @@ cmdret *cmd_describekey(int interactive, struct cmdarg **args)
         grab_rat();
         rat_grabbed = 1;
     }
-    read_single_key(&keysym, &mod, NULL, 0);
+    read_single_key(&keysym, &mod, NULL, 0, 0);
 
     if (rat_grabbed)
         ungrab_rat();
@@ -5757,6 +6511,7 @@ cmdret *cmd_dedicate(int interactive, struct cmdarg **args)
     } else
         /* Just toggle it, rather than on or off. */
         f->dedicated = !(f->dedicated);
+    snapshot_touch();
 
     return cmdret_new(RET_SUCCESS, "Consider this frame %s.",
                       f->dedicated ? "chaste" : "promiscuous");
@@ -5823,6 +6578,57 @@ cmdret *cmd_commands(int interactive, struct cmdarg **args)
     return ret;
 }
 
+/*
+ * latency [on|off|reset|glyphs|csv [file]]. With no argument, summarize the
+ * samples taken so far. glyphs shows how well each screen's glyph cache is
+ * doing instead.
+ */
+cmdret *cmd_latency(int interactive, struct cmdarg **args)
+{
+    struct sbuf *buf;
+    cmdret *ret;
+    FILE *f;
+    char *arg = args[0] ? ARG_STRING(0) : NULL;
+
+    if (arg && !strcmp(arg, "on")) {
+        latency_enable(1);
+        return cmdret_new(RET_SUCCESS, NULL);
+    } else if (arg && !strcmp(arg, "off")) {
+        latency_enable(0);
+        return cmdret_new(RET_SUCCESS, NULL);
+    } else if (arg && !strcmp(arg, "reset")) {
+        latency_reset();
+        return cmdret_new(RET_SUCCESS, NULL);
+    } else if (arg && strcmp(arg, "csv") && strcmp(arg, "glyphs")) {
+        return cmdret_new(RET_FAILURE, "latency: unknown argument '%s'",
+                          arg);
+    }
+
+    buf = sbuf_new(0);
+    if (arg == NULL) {
+        latency_summary(buf);
+    } else if (!strcmp(arg, "glyphs")) {
+        glyph_cache_stats(buf);
+        sbuf_chop(buf);
+    } else {
+        latency_csv(buf);
+        if (args[1]) {
+            if ((f = fopen(ARG_STRING(1), "w")) == NULL) {
+                sbuf_free(buf);
+                return cmdret_new(RET_FAILURE, "latency: %s: %s",
+                                  ARG_STRING(1), strerror(errno));
+            }
+            fputs(sbuf_get(buf), f);
+            fclose(f);
+            sbuf_clear(buf);
+        }
+    }
+
+    ret = cmdret_new(RET_SUCCESS, "%s", sbuf_get(buf));
+    sbuf_free(buf);
+    return ret;
+}
+
 cmdret *cmd_wallpaper(int interactive, struct cmdarg **args)
 {
     struct wallpaper_state state;
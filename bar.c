@@ -375,7 +375,10 @@ static void
 draw_partial_string(rp_screen *s, char *msg, int len, int x_offset,
                     int y_offset, int style, char *color)
 {
-    rp_draw_string(s, s->bar_window, style,
+    if (s->bar_buf.back.draw == NULL)
+        return;
+
+    rp_draw_string_on(s, s->bar_buf.back.draw, style,
                    defaults.bar_x_padding + x_offset,
                    defaults.bar_y_padding + FONT_ASCENT(s) +
                    y_offset * FONT_HEIGHT(s), msg, len + 1, NULL, color);
@@ -443,8 +446,6 @@ draw_string(rp_screen *s, char *msg, int mark_start, int mark_end)
     /* Print the last line. */
     draw_partial_string(s, msg + start, part_len, x_offset, y_offset,
                         style, NULL);
-
-    XSync(dpy, False);
 }
 #undef REASON_NONE
 #undef REASON_STYLE
@@ -478,15 +479,27 @@ static void correct_mark(int msg_len, int *mark_start, int *mark_end)
     }
 }
 
-/* Raise the bar and put it in the right spot */
-static void prepare_bar(rp_screen *s, int width, int height, int bar_type)
+/* Clip the bar to the screen and work out where it goes. */
+static void
+bar_geometry(rp_screen *s, int *x, int *y, int *width, int *height)
 {
-    width = width < s->width ? width : s->width;
+    *width = *width < s->width ? *width : s->width;
     if (!defaults.bar_in_padding)
-        width -= defaults.padding_right + defaults.padding_left;
-    height = height < s->height ? height : s->height;
-    XMoveResizeWindow(dpy, s->bar_window, bar_x(s, width),
-                      bar_y(s, height), width, height);
+        *width -= defaults.padding_right + defaults.padding_left;
+    *height = *height < s->height ? *height : s->height;
+    *x = bar_x(s, *width);
+    *y = bar_y(s, *height);
+}
+
+/* Raise the bar and put it in the right spot */
+static void
+prepare_bar(rp_screen *s, int x, int y, int width, int height, int bar_type)
+{
+    struct rp_bar_buffer *b = &s->bar_buf;
+
+    if (x != b->x || y != b->y || width != b->width
+        || height != b->height)
+        XMoveResizeWindow(dpy, s->bar_window, x, y, width, height);
 
     /* Map the bar if needed */
     if (!BAR_IS_RAISED(s)) {
@@ -507,11 +520,8 @@ static void prepare_bar(rp_screen *s, int width, int height, int bar_type)
         }
     }
     XRaiseWindow(dpy, s->bar_window);
-    XClearWindow(dpy, s->bar_window);
 
     raise_utility_windows();
-
-    XSync(dpy, False);
 }
 
 static void
@@ -581,16 +591,10 @@ get_mark_box(char *msg, size_t mark_start, size_t mark_end, int *x, int *y,
 
 static void draw_box(rp_screen *s, int x, int y, int width, int height)
 {
-    XGCValues lgv;
-    GC lgc;
-    unsigned long mask;
+    struct rp_back_buffer *b = &s->bar_buf.back;
 
-    lgv.foreground = rp_glob_screen.fgcolor;
-    mask = GCForeground;
-    lgc = XCreateGC(dpy, s->root, mask, &lgv);
-
-    XFillRectangle(dpy, s->bar_window, lgc, x, y, width, height);
-    XFreeGC(dpy, lgc);
+    XSetForeground(dpy, b->gc, rp_glob_screen.fgcolor);
+    XFillRectangle(dpy, b->pixmap, b->gc, x, y, width, height);
 }
 
 static void
@@ -606,6 +610,99 @@ draw_mark(rp_screen *s, char *msg, int mark_start, int mark_end)
     draw_box(s, x, y, width, height);
 }
 
+/* Where the marked region starts and ends, in lines and columns. */
+static void
+mark_position(char *msg, int mark_start, int mark_end, int pos[4])
+{
+    pos[0] = count_lines(msg, mark_start);
+    pos[1] = pos_in_line(msg, mark_start);
+    pos[2] = count_lines(msg, mark_end);
+    pos[3] = pos_in_line(msg, mark_end);
+}
+
+static void mark_lines(int from, int to, int *first, int *last)
+{
+    if (*first < 0 || from < *first)
+        *first = from;
+    if (to > *last)
+        *last = to;
+}
+
+/*
+ * Work out which lines of the bar differ from what it shows now. The bar
+ * must already be the same size. Returns 0 if there is nothing to redraw.
+ */
+static int
+bar_dirty_lines(rp_screen *s, char *msg, int mark_start, int mark_end,
+                int *first, int *last)
+{
+    struct rp_bar_buffer *b = &s->bar_buf;
+    char *old = b->text, *new = msg;
+    size_t old_len, new_len;
+    int old_mark[4], new_mark[4];
+    int line;
+
+    *first = *last = -1;
+
+    for (line = 0;; line++) {
+        old_len = strcspn(old, "\n");
+        new_len = strcspn(new, "\n");
+        if (old_len != new_len || memcmp(old, new, old_len))
+            mark_lines(line, line, first, last);
+        if (old[old_len] == '\0' || new[new_len] == '\0')
+            break;
+        old += old_len + 1;
+        new += new_len + 1;
+    }
+
+    mark_position(b->text, b->mark_start, b->mark_end, old_mark);
+    mark_position(msg, mark_start, mark_end, new_mark);
+    if (b->mark_start == b->mark_end)
+        old_mark[0] = 0;
+    if (mark_start == mark_end)
+        new_mark[0] = 0;
+
+    if (memcmp(old_mark, new_mark, sizeof(old_mark))) {
+        if (old_mark[0])
+            mark_lines(old_mark[0] - 1, old_mark[2] - 1, first, last);
+        if (new_mark[0])
+            mark_lines(new_mark[0] - 1, new_mark[2] - 1, first, last);
+    }
+
+    return *first >= 0;
+}
+
+/* Draw the whole bar into the back buffer. */
+static void
+bar_render(rp_screen *s, char *msg, int mark_start, int mark_end,
+           int width, int height)
+{
+    struct rp_back_buffer *b = &s->bar_buf.back;
+
+    if (back_buffer_reserve(s, b, width, height))
+        invalidate_bar(s);
+
+    XSetForeground(dpy, b->gc, rp_glob_screen.bgcolor);
+    XFillRectangle(dpy, b->pixmap, b->gc, 0, 0, width, height);
+
+    /* Draw the mark over the designated part of the string. */
+    draw_mark(s, msg, mark_start, mark_end);
+    draw_string(s, msg, mark_start, mark_end);
+}
+
+/* Forget what the bar shows so the next message redraws all of it. */
+void invalidate_bar(rp_screen *s)
+{
+    free(s->bar_buf.text);
+    s->bar_buf.text = NULL;
+}
+
+void free_bar_buffer(rp_screen *s)
+{
+    invalidate_bar(s);
+    back_buffer_free(&s->bar_buf.back);
+}
+
 static void update_last_message(char *msg, int mark_start, int mark_end)
 {
     free(last_msg);
@@ -626,11 +723,15 @@ marked_message_internal(char *msg, int mark_start, int mark_end,
                         int bar_type)
 {
     rp_screen *s;
+    struct rp_bar_buffer *b;
     int num_lines;
+    int x, y;
     int width;
     int height;
+    int first, last;
 
     s = rp_current_screen;
+    b = &s->bar_buf;
 
     PRINT_DEBUG(("msg = %s\n", msg ? msg : "NULL"));
     PRINT_DEBUG(("mark_start = %d, mark_end = %d\n", mark_start,
@@ -643,13 +744,51 @@ marked_message_internal(char *msg, int mark_start, int mark_end,
         width -= defaults.padding_right + defaults.padding_left;
     height = FONT_HEIGHT(s) * num_lines + defaults.bar_y_padding * 2;
 
-    prepare_bar(s, width, height, bar_type);
-
-    /* Draw the mark over the designated part of the string. */
+    bar_geometry(s, &x, &y, &width, &height);
     correct_mark(strlen(msg), &mark_start, &mark_end);
-    draw_mark(s, msg, mark_start, mark_end);
 
-    draw_string(s, msg, mark_start, mark_end);
+    /*
+     * Render before mapping or resizing the bar, so the server paints the
+     * new contents straight from the background.
+     */
+    if (b->text == NULL || x != b->x || y != b->y || width != b->width
+        || height != b->height) {
+        first = 0;
+        last = num_lines - 1;
+        bar_render(s, msg, mark_start, mark_end, width, height);
+    } else if (bar_dirty_lines(s, msg, mark_start, mark_end, &first,
+                               &last)) {
+        bar_render(s, msg, mark_start, mark_end, width, height);
+    } else {
+        first = -1;
+    }
+
+    /* Install the new contents, the old background may be a copy. */
+    if (first >= 0)
+        XSetWindowBackgroundPixmap(dpy, s->bar_window, b->back.pixmap);
+
+    prepare_bar(s, x, y, width, height, bar_type);
+
+    if (first == 0)
+        XCopyArea(dpy, b->back.pixmap, s->bar_window, b->back.gc, 0, 0,
+                  width, height, 0, 0);
+    else if (first > 0)
+        XCopyArea(dpy, b->back.pixmap, s->bar_window, b->back.gc, 0,
+                  defaults.bar_y_padding + first * FONT_HEIGHT(s), width,
+                  (last - first + 1) * FONT_HEIGHT(s), 0,
+                  defaults.bar_y_padding + first * FONT_HEIGHT(s));
+
+    if (first >= 0) {
+        free(b->text);
+        b->text = xstrdup(msg);
+        b->mark_start = mark_start;
+        b->mark_end = mark_end;
+    }
+    b->x = x;
+    b->y = y;
+    b->width = width;
+    b->height = height;
+    XFlush(dpy);
 
     /* Keep a record of the message. */
     update_last_message(msg, mark_start, mark_end);
@@ -0,0 +1,40 @@
+/*
+ * Helpers shared by the benchmarks.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* Monotonic time in nanoseconds. */
+static inline double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Print how long each of n runs took on average since start. */
+static inline void bench_report(const char *what, double start, long n)
+{
+    printf("%-40s %10.0f ns/op\n", what, (bench_now() - start) / n);
+}
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Time the frame neighbour queries on large framesets, and check the frame
+ * index against a scan of every frame while frames are resized.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+#include <err.h>
+#include <string.h>
+
+#include "poison.h"
+#include "bench/bench.h"
+
+#define SCREEN_WIDTH	3840
+#define SCREEN_HEIGHT	2160
+#define PASSES		200
+#define RESIZES		500
+
+static rp_screen screen;
+
+/* A vscreen without frames, for the caller to tile. */
+static rp_vscreen *frameset_new(void)
+{
+    rp_vscreen *v;
+    rp_frame *f;
+
+    v = xmalloc(sizeof(rp_vscreen));
+    memset(v, 0, sizeof(rp_vscreen));
+    init_vscreen(v, &screen);
+
+    /* Throw away the full screen frame it starts with. */
+    list_first(f, &v->frames, node);
+    list_del(&f->node);
+    frame_free(v, f);
+
+    return v;
+}
+
+static void frameset_add(rp_vscreen *v, int x, int y, int width, int height)
+{
+    rp_frame *f;
+
+    f = frame_new(v);
+    f->x = x;
+    f->y = y;
+    f->width = width;
+    f->height = height;
+    list_add_tail(&f->node, &v->frames);
+}
+
+static void frameset_done(rp_vscreen *v)
+{
+    v->current_frame = 0;
+    frames_changed(v);
+    frame_windows_changed(v);
+    split_tree_forget(v);
+}
+
+/*
+ * A vscreen tiled with rows of frames. Every other row is offset by half a
+ * column, so most frames have two neighbours above and below to pick from.
+ */
+static rp_vscreen *grid_new(int rows, int cols)
+{
+    rp_vscreen *v;
+    int r, x, y, w, h, next;
+
+    v = frameset_new();
+    w = SCREEN_WIDTH / cols;
+    h = SCREEN_HEIGHT / rows;
+    for (r = 0; r < rows; r++) {
+        y = r * h;
+        for (x = 0; x < SCREEN_WIDTH; x = next) {
+            next = x + (r % 2 && x == 0 ? w / 2 : w);
+            if (SCREEN_WIDTH - next < w / 2)
+                next = SCREEN_WIDTH;
+            frameset_add(v, x, y, next - x,
+                         r == rows - 1 ? SCREEN_HEIGHT - y : h);
+        }
+    }
+    frameset_done(v);
+
+    return v;
+}
+
+/*
+ * A vscreen tiled with pinwheels of five frames, four around one in the
+ * middle. No line cuts a pinwheel in two, so there is no split tree and
+ * resizing goes through the frame index.
+ */
+static rp_vscreen *pinwheels_new(int tiles)
+{
+    rp_vscreen *v;
+    int i, j, x, y, w, h;
+
+    v = frameset_new();
+    w = SCREEN_WIDTH / tiles / 3;
+    h = SCREEN_HEIGHT / tiles / 3;
+    for (i = 0; i < tiles; i++) {
+        for (j = 0; j < tiles; j++) {
+            x = j * w * 3;
+            y = i * h * 3;
+            frameset_add(v, x, y, w * 2, h);
+            frameset_add(v, x + w * 2, y, w, h * 2);
+            frameset_add(v, x + w, y + h * 2, w * 2, h);
+            frameset_add(v, x, y + h, w, h * 2);
+            frameset_add(v, x + w, y + h, w, h);
+        }
+    }
+    frameset_done(v);
+
+    return v;
+}
+
+static void frameset_destroy(rp_vscreen *v)
+{
+    vscreen_free(v);
+    numset_free(v->frames_numset);
+    numset_free(v->numset);
+    free(v->name);
+    free(v);
+}
+
+/*
+ * The neighbour of frame on side, found by looking at every frame: of those
+ * whose other side is where frame's is, the one lined up best with it along
+ * the edge, and the lower numbered one of two that are lined up as well.
+ */
+static rp_frame *scan_neighbour(rp_frame *frame, int side)
+{
+    static const int facing[SIDES] = {
+        [SIDE_TOP] = SIDE_BOTTOM, [SIDE_BOTTOM] = SIDE_TOP,
+        [SIDE_LEFT] = SIDE_RIGHT, [SIDE_RIGHT] = SIDE_LEFT
+    };
+    rp_frame *cur, *winner = NULL;
+    int along, gap, wingap = 0;
+
+    list_for_each_entry(cur, &frame->vscreen->frames, node) {
+        if (frame_side(cur, facing[side]) != frame_side(frame, side))
+            continue;
+
+        if (side == SIDE_TOP || side == SIDE_BOTTOM)
+            along = frame_left(frame) - frame_left(cur);
+        else
+            along = frame_top(frame) - frame_top(cur);
+        gap = abs(along);
+
+        if (!winner || gap < wingap
+            || (gap == wingap && cur->number < winner->number)) {
+            winner = cur;
+            wingap = gap;
+        }
+    }
+
+    return winner;
+}
+
+static rp_frame *index_neighbour(rp_frame *frame, int side)
+{
+    switch (side) {
+    case SIDE_TOP:
+        return find_frame_up(frame);
+    case SIDE_BOTTOM:
+        return find_frame_down(frame);
+    case SIDE_LEFT:
+        return find_frame_left(frame);
+    default:
+        return find_frame_right(frame);
+    }
+}
+
+/* Check every frame's neighbours in the index against a scan. */
+static void check(rp_vscreen *v, const char *when)
+{
+    rp_frame *cur, *got, *want;
+    int side;
+
+    list_for_each_entry(cur, &v->frames, node) {
+        for (side = 0; side < SIDES; side++) {
+            got = index_neighbour(cur, side);
+            want = scan_neighbour(cur, side);
+            if (got != want)
+                errx(1, "%s: frame %d side %d: index found %d, "
+                     "scan found %d", when, cur->number, side,
+                     got ? got->number : -1, want ? want->number : -1);
+        }
+    }
+}
+
+static void bench(int rows, int cols)
+{
+    rp_vscreen *v;
+    rp_frame *cur;
+    int pass, side, n;
+    double start;
+    char what[64];
+
+    v = grid_new(rows, cols);
+    n = num_frames(v);
+    check(v, "grid");
+
+    start = bench_now();
+    for (pass = 0; pass < PASSES; pass++) {
+        list_for_each_entry(cur, &v->frames, node) {
+            for (side = 0; side < SIDES; side++)
+                index_neighbour(cur, side);
+        }
+    }
+    snprintf(what, sizeof(what), "index, %d frames", n);
+    bench_report(what, start, (long) PASSES * n * SIDES);
+
+    start = bench_now();
+    for (pass = 0; pass < PASSES; pass++) {
+        list_for_each_entry(cur, &v->frames, node) {
+            for (side = 0; side < SIDES; side++)
+                scan_neighbour(cur, side);
+        }
+    }
+    snprintf(what, sizeof(what), "scan, %d frames", n);
+    bench_report(what, start, (long) PASSES * n * SIDES);
+
+    frameset_destroy(v);
+}
+
+/* Resize random frames of v, checking the index after each one. */
+static void resizes(rp_vscreen *v, const char *what)
+{
+    rp_frame *frame, before;
+    int i, number, diff, moved = 0;
+    char when[64];
+
+    srand(num_frames(v));
+
+    for (i = 0; i < RESIZES; i++) {
+        number = rand() % num_frames(v);
+        frame = find_frame_number(v, number);
+        diff = rand() % 81 - 40;
+        before = *frame;
+
+        if (rand() % 2)
+            resize_frame_horizontally(frame, diff);
+        else
+            resize_frame_vertically(frame, diff);
+        if (frame->width != before.width || frame->height != before.height)
+            moved++;
+
+        snprintf(when, sizeof(when), "%s, resize %d", what, i);
+        check(v, when);
+    }
+    printf("%s: %d resizes of %d frames checked, %d moved\n", what,
+           RESIZES, num_frames(v), moved);
+
+    frameset_destroy(v);
+}
+
+int main(void)
+{
+    screen.width = SCREEN_WIDTH;
+    screen.height = SCREEN_HEIGHT;
+    screen.vscreens_numset = numset_new();
+    INIT_LIST_HEAD(&screen.vscreens);
+
+    bench(8, 8);
+    bench(16, 16);
+    bench(32, 32);
+    resizes(grid_new(16, 16), "grid");
+    resizes(pinwheels_new(8), "pinwheels");
+
+    return 0;
+}
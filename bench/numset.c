@@ -0,0 +1,146 @@
+/*
+ * Time numset requests and releases on sets of a few hundred numbers and
+ * more, against the array the numset used to be.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+#include <err.h>
+#include <string.h>
+
+#include "poison.h"
+#include "bench/bench.h"
+
+#define CHURN	20000
+
+/*
+ * The numset as it was: an unsorted array of taken numbers, with -1 for a
+ * released slot, searched from the start for every number tried.
+ */
+struct array_set {
+    int *taken;
+    int num_taken, max_taken;
+};
+
+static int array_add_num(struct array_set *as, int n)
+{
+    int i, cell = -1;
+
+    for (i = 0; i < as->num_taken; i++) {
+        if (as->taken[i] == n)
+            return 0;
+    }
+    for (i = 0; i < as->num_taken; i++) {
+        if (as->taken[i] == -1) {
+            cell = i;
+            break;
+        }
+    }
+    if (cell < 0) {
+        if (as->num_taken >= as->max_taken) {
+            as->max_taken = as->max_taken ? as->max_taken * 2 : 10;
+            as->taken = xrealloc(as->taken, sizeof(int) * as->max_taken);
+        }
+        cell = as->num_taken++;
+    }
+    as->taken[cell] = n;
+    return 1;
+}
+
+static int array_request(struct array_set *as)
+{
+    int i = 0;
+
+    while (!array_add_num(as, i))
+        i++;
+    return i;
+}
+
+static void array_release(struct array_set *as, int n)
+{
+    int i;
+
+    for (i = 0; i < as->num_taken; i++) {
+        if (as->taken[i] == n) {
+            as->taken[i] = -1;
+            return;
+        }
+    }
+}
+
+/*
+ * Take n numbers, then release a random one and request a number CHURN
+ * times, as frames and windows come and go. Both sets must hand out the
+ * same numbers.
+ */
+static void run(int n)
+{
+    struct array_set as;
+    struct numset *ns;
+    int *order, i, got, want;
+    double start;
+    char what[64];
+
+    order = xmalloc(CHURN * sizeof(int));
+    srand(n);
+    for (i = 0; i < CHURN; i++)
+        order[i] = rand() % n;
+
+    memset(&as, 0, sizeof(as));
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        array_request(&as);
+    for (i = 0; i < CHURN; i++) {
+        array_release(&as, order[i]);
+        array_request(&as);
+    }
+    snprintf(what, sizeof(what), "array, n=%d", n);
+    bench_report(what, start, n + CHURN);
+
+    ns = numset_new();
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        numset_request(ns);
+    for (i = 0; i < CHURN; i++) {
+        numset_release(ns, order[i]);
+        numset_request(ns);
+    }
+    snprintf(what, sizeof(what), "bitmap, n=%d", n);
+    bench_report(what, start, n + CHURN);
+
+    /* Release every other number, and check both give them back in order. */
+    for (i = 0; i < n; i += 2) {
+        array_release(&as, i);
+        numset_release(ns, i);
+    }
+    for (i = 0; i < n; i++) {
+        want = array_request(&as);
+        if ((got = numset_request(ns)) != want)
+            errx(1, "n=%d: numset gave %d, expected %d", n, got, want);
+    }
+
+    numset_free(ns);
+    free(as.taken);
+    free(order);
+}
+
+int main(void)
+{
+    run(200);
+    run(500);
+    run(1000);
+
+    return 0;
+}
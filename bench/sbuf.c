@@ -0,0 +1,148 @@
+/*
+ * Time building the window list of a vscreen with 500 windows.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "poison.h"
+#include "bench/bench.h"
+
+#define WINDOWS	500
+#define RUNS	2000
+
+/*
+ * The string buffer as it was before sbufs grew geometrically: every append
+ * reallocs to the exact size, and printf formats into a temporary first.
+ */
+struct exact_buf {
+    char *data;
+    size_t len, maxsz;
+};
+
+static void exact_concat(struct exact_buf *b, const char *str)
+{
+    size_t len = strlen(str), minsz = b->len + len + 1;
+
+    if (b->maxsz < minsz) {
+        b->data = xrealloc(b->data, minsz);
+        b->maxsz = minsz;
+    }
+    memcpy(b->data + b->len, str, len + 1);
+    b->len += len;
+}
+
+static void exact_printf_concat(struct exact_buf *b, char *fmt, ...)
+{
+    char *buffer;
+    va_list ap;
+
+    va_start(ap, fmt);
+    buffer = xvsprintf(fmt, ap);
+    va_end(ap);
+
+    exact_concat(b, buffer);
+    free(buffer);
+}
+
+/* A vscreen with one frame and WINDOWS mapped windows, made current. */
+static void setup(void)
+{
+    static rp_screen screen;
+    static rp_vscreen vscreen;
+    rp_window *win;
+    int i;
+
+    screen.width = 1920;
+    screen.height = 1080;
+    screen.vscreens_numset = numset_new();
+    INIT_LIST_HEAD(&screen.vscreens);
+    init_vscreen(&vscreen, &screen);
+    list_add_tail(&vscreen.node, &screen.vscreens);
+    screen.current_vscreen = &vscreen;
+    list_add_tail(&screen.node, &rp_screens);
+    rp_current_screen = &screen;
+
+    defaults.window_fmt = xstrdup("%n%s%t");
+
+    for (i = 0; i < WINDOWS; i++) {
+        win = xmalloc(sizeof(rp_window));
+        memset(win, 0, sizeof(rp_window));
+        win->number = i;
+        win->vscreen = &vscreen;
+        win->frame_number = EMPTY;
+        win->sticky_frame = EMPTY;
+        win->user_name = xstrdup("xterm");
+        win->wm_name = xsprintf("user@host: ~/src/poison (%d)", i);
+        list_add_tail(&win->node, &rp_mapped_window);
+        vscreen_add_window(&vscreen, win);
+        vscreen_map_window(&vscreen, win);
+    }
+}
+
+int main(void)
+{
+    struct exact_buf exact;
+    struct sbuf *sb;
+    rp_window_elem *we;
+    int i, mark_start, mark_end;
+    double start;
+
+    setup();
+    printf("%d windows, %d runs\n", WINDOWS, RUNS);
+
+    /* The same appends get_window_list makes, on both kinds of buffer. */
+    start = bench_now();
+    for (i = 0; i < RUNS; i++) {
+        memset(&exact, 0, sizeof(exact));
+        exact_concat(&exact, "");
+        list_for_each_entry(we, &rp_current_vscreen->mapped_windows, node) {
+            exact_printf_concat(&exact, "%d%c%s", we->number, '-',
+                                window_name(we->win));
+            exact_concat(&exact, ", ");
+        }
+        free(exact.data);
+    }
+    bench_report("list, exact sized appends", start, RUNS);
+
+    start = bench_now();
+    for (i = 0; i < RUNS; i++) {
+        sb = sbuf_new(0);
+        list_for_each_entry(we, &rp_current_vscreen->mapped_windows, node) {
+            sbuf_printf_concat(sb, "%d%c%s", we->number, '-',
+                               window_name(we->win));
+            sbuf_concat(sb, ", ");
+        }
+        sbuf_free(sb);
+    }
+    bench_report("list, sbuf", start, RUNS);
+
+    /* And the real thing, formats and all. */
+    sb = sbuf_new(0);
+    start = bench_now();
+    for (i = 0; i < RUNS; i++) {
+        sbuf_free(sb);
+        sb = sbuf_new(0);
+        get_window_list(defaults.window_fmt, ", ", sb, &mark_start,
+                        &mark_end);
+    }
+    bench_report("get_window_list", start, RUNS);
+    printf("list is %zu bytes\n", sb->len);
+    sbuf_free(sb);
+
+    return 0;
+}
@@ -0,0 +1,559 @@
+/*
+ * Command socket.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+/*
+ * Scripts run commands through a Unix socket whose path is exported in
+ * POISON_SOCKET. Every line a client sends is run with command() and answered
+ * with a header line, "ok <length>" or "error <length>", followed by that many
+ * bytes of output. Clients may send as many commands as they like before
+ * reading the replies. All of it is non-blocking and driven by the main poll
+ * loop, so a slow client never holds up the window manager.
+ *
+ * A client that sends "subscribe [class ...]" gets an "ok" and from then on a
+ * line for every event of those classes, or of all of them when none are
+ * named. The classes are the hook names. Each line is tab separated:
+ *
+ *   class window-id window-number vscreen frame title
+ *
+ * with -1 or 0x0 for whatever doesn't apply. Events are collected while the
+ * event loop works through a batch and sent once it's done, keeping only the
+ * last one of a class, or of a class and window when the event is about a
+ * particular window. A subscriber that falls too far behind loses its oldest
+ * events. Anything else it sends is ignored.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "poison.h"
+
+/* A client sending a longer line than this is disconnected. */
+#define CONTROL_MAX_LINE 65536
+
+/* Stop reading from a client while more replies than this are queued. */
+#define CONTROL_MAX_PENDING 262144
+
+/* How much a subscriber can fall behind before events are dropped. */
+#define CONTROL_MAX_EVENTS 65536
+
+struct control_client {
+    int fd;
+
+    /* What has been read but not run yet. */
+    struct sbuf *in;
+
+    /* Replies not written yet. */
+    struct sbuf *out;
+
+    /* The client won't send any more. */
+    int eof;
+
+    /* A bit for each rp_hook_db entry the client is subscribed to. */
+    unsigned long events;
+
+    /* The start of out that can't be dropped to make room for events. */
+    size_t pinned;
+
+    struct list_head node;
+};
+
+/* An event waiting for the end of the batch. */
+struct control_event {
+    int class;
+
+    /* The window it's about, or None if it's only about the class. */
+    Window w;
+
+    struct sbuf *record;
+    struct list_head node;
+};
+
+static int listen_fd = -1;
+static char *socket_path;
+static LIST_HEAD(clients);
+static int nclients;
+
+static LIST_HEAD(events);
+
+/* Every class somebody is subscribed to. */
+static unsigned long subscribed;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    return 0;
+}
+
+void init_control(void)
+{
+    struct sockaddr_un addr;
+    const char *dir;
+    mode_t mask;
+
+    dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || *dir == '\0')
+        dir = "/tmp";
+
+    socket_path = xsprintf("%s/poison-%d.sock", dir, (int) getpid());
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        warnx("command socket path too long: %s", socket_path);
+        goto fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        warn("socket");
+        goto fail;
+    }
+    set_close_on_exec(listen_fd);
+    set_nonblocking(listen_fd);
+
+    /* Only we get to connect to it. */
+    unlink(socket_path);
+    mask = umask(077);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        warn("bind %s", socket_path);
+        umask(mask);
+        goto fail;
+    }
+    umask(mask);
+
+    if (listen(listen_fd, 16) < 0) {
+        warn("listen %s", socket_path);
+        unlink(socket_path);
+        goto fail;
+    }
+
+    setenv("POISON_SOCKET", socket_path, 1);
+    return;
+
+  fail:
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+    free(socket_path);
+    socket_path = NULL;
+}
+
+static void update_subscribed(void)
+{
+    struct control_client *c;
+
+    subscribed = 0;
+    list_for_each_entry(c, &clients, node)
+        subscribed |= c->events;
+}
+
+static void client_free(struct control_client *c)
+{
+    list_del(&c->node);
+    close(c->fd);
+    sbuf_free(c->in);
+    sbuf_free(c->out);
+    nclients--;
+    if (c->events)
+        update_subscribed();
+    free(c);
+}
+
+static void control_accept(void)
+{
+    struct control_client *c;
+    int fd;
+
+    while (nclients < CONTROL_MAX_CLIENTS) {
+        if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                warn("accept");
+            return;
+        }
+        set_close_on_exec(fd);
+        if (set_nonblocking(fd) < 0) {
+            close(fd);
+            continue;
+        }
+
+        c = xmalloc(sizeof(struct control_client));
+        c->fd = fd;
+        c->in = sbuf_new(0);
+        c->out = sbuf_new(0);
+        c->eof = 0;
+        c->events = 0;
+        c->pinned = 0;
+        list_add_tail(&c->node, &clients);
+        nclients++;
+    }
+}
+
+static void client_reply(struct control_client *c, int success,
+                         char *output)
+{
+    if (output == NULL)
+        output = "";
+
+    sbuf_printf_concat(c->out, "%s %zu\n", success ? "ok" : "error",
+                       strlen(output));
+    sbuf_concat(c->out, output);
+}
+
+/* Subscribe c to the classes named in str, or to all of them. */
+static void client_subscribe(struct control_client *c, char *str)
+{
+    unsigned long mask = 0;
+    char *word, *last;
+    int i;
+
+    for (word = strtok_r(str, " \t", &last); word;
+         word = strtok_r(NULL, " \t", &last)) {
+        for (i = 0; rp_hook_db[i].name; i++)
+            if (!strcmp(word, rp_hook_db[i].name))
+                break;
+
+        if (rp_hook_db[i].name == NULL) {
+            word = xsprintf("unknown event class '%s'", word);
+            client_reply(c, 0, word);
+            free(word);
+            return;
+        }
+        mask |= 1UL << i;
+    }
+
+    if (mask == 0) {
+        for (i = 0; rp_hook_db[i].name; i++)
+            mask |= 1UL << i;
+    }
+
+    client_reply(c, 1, NULL);
+
+    /* Replies still queued must go out whole. */
+    c->pinned = c->out->len;
+    c->events = mask;
+    update_subscribed();
+}
+
+static void client_run(struct control_client *c, char *line)
+{
+    cmdret *ret;
+    size_t len;
+
+    len = strlen(line);
+    if (len && line[len - 1] == '\r')
+        line[len - 1] = '\0';
+
+    PRINT_DEBUG(("control: %s\n", line));
+
+    if (c->events)
+        return;
+
+    if (!strncmp(line, "subscribe", 9)
+        && (line[9] == '\0' || isspace((unsigned char) line[9]))) {
+        client_subscribe(c, line + 9);
+        return;
+    }
+
+    ret = command(0, line);
+    client_reply(c, ret ? ret->success : 1, ret ? ret->output : NULL);
+    if (ret)
+        cmdret_free(ret);
+}
+
+/* Run every complete line the client has sent. */
+static void client_run_lines(struct control_client *c)
+{
+    char *start, *nl;
+    size_t used;
+
+    start = sbuf_get(c->in);
+    while ((nl = strchr(start, '\n'))) {
+        *nl = '\0';
+        client_run(c, start);
+        start = nl + 1;
+    }
+
+    /* A last line with no newline still counts once the client is done. */
+    if (c->eof && *start) {
+        client_run(c, start);
+        start += strlen(start);
+    }
+
+    used = start - sbuf_get(c->in);
+    sbuf_drop(c->in, used);
+}
+
+/* Return -1 if the client should be dropped. */
+static int client_read(struct control_client *c)
+{
+    char buf[8192];
+    ssize_t n;
+
+    n = read(c->fd, buf, sizeof(buf));
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK
+                || errno == EINTR) ? 0 : -1;
+
+    if (n == 0)
+        c->eof = 1;
+    else if (memchr(buf, '\0', n))
+        return -1;
+    else
+        sbuf_nconcat(c->in, buf, n);
+
+    client_run_lines(c);
+
+    if (c->in->len > CONTROL_MAX_LINE) {
+        warnx("command socket line too long");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Return -1 if the client should be dropped. */
+static int client_write(struct control_client *c)
+{
+    ssize_t n;
+    char *nl;
+    int whole;
+
+    if (c->out->len == 0)
+        return 0;
+
+    n = send(c->fd, sbuf_get(c->out), c->out->len, MSG_NOSIGNAL);
+    if (n <= 0)
+        return (n == 0 || errno == EAGAIN || errno == EWOULDBLOCK
+                || errno == EINTR) ? 0 : -1;
+
+    whole = sbuf_get(c->out)[n - 1] == '\n';
+    sbuf_drop(c->out, n);
+    c->pinned = c->pinned > (size_t) n ? c->pinned - n : 0;
+
+    /* The rest of a line we've started on has to follow it. */
+    if (c->events && !whole && c->pinned == 0) {
+        nl = memchr(sbuf_get(c->out), '\n', c->out->len);
+        c->pinned = nl ? (size_t) (nl - sbuf_get(c->out)) + 1 : c->out->len;
+    }
+
+    return 0;
+}
+
+/* Make room in c's queue by dropping the oldest events it hasn't started on. */
+static void client_drop_events(struct control_client *c)
+{
+    char *data = sbuf_get(c->out), *nl;
+    size_t cut, len = c->out->len;
+
+    if (len <= CONTROL_MAX_EVENTS || c->pinned >= len)
+        return;
+
+    cut = c->pinned + (len - CONTROL_MAX_EVENTS);
+    if (cut > len)
+        cut = len;
+
+    /* Only whole lines go. */
+    nl = memchr(data + cut - 1, '\n', len - cut + 1);
+    cut = nl ? (size_t) (nl - data) + 1 : len;
+
+    memmove(data + c->pinned, data + cut, len - cut + 1);
+    c->out->len -= cut - c->pinned;
+}
+
+/*
+ * Note an event for subscribers. win is the window it's about, or NULL for
+ * events that are about the current window.
+ */
+void control_event(struct list_head *hook, rp_window *win)
+{
+    struct control_event *ev;
+    rp_vscreen *v;
+    rp_frame *f;
+    Window w;
+    char *p;
+    size_t start;
+    int class;
+
+    if (subscribed == 0)
+        return;
+
+    for (class = 0; rp_hook_db[class].name; class++)
+        if (rp_hook_db[class].hook == hook)
+            break;
+    if (rp_hook_db[class].name == NULL || !(subscribed & (1UL << class)))
+        return;
+
+    w = win ? win->w : None;
+    if (win == NULL)
+        win = current_window();
+
+    /* Only the latest event for the same thing is kept. */
+    list_for_each_entry(ev, &events, node) {
+        if (ev->class == class && ev->w == w)
+            break;
+    }
+    if (&ev->node == &events) {
+        ev = xmalloc(sizeof(struct control_event));
+        ev->class = class;
+        ev->w = w;
+        ev->record = sbuf_new(0);
+    } else {
+        list_del(&ev->node);
+    }
+    list_add_tail(&ev->node, &events);
+
+    v = win ? win->vscreen : rp_current_vscreen;
+    f = win ? find_windows_frame(win) : NULL;
+    if (win == NULL && v)
+        f = current_frame(v);
+
+    sbuf_printf(ev->record, "%s\t0x%lx\t%d\t%d\t%d\t",
+                rp_hook_db[class].name, win ? win->w : 0UL,
+                win ? win->number : -1, v ? v->number : -1,
+                f ? f->number : -1);
+
+    start = ev->record->len;
+    if (win && window_name(win))
+        sbuf_concat(ev->record, window_name(win));
+    for (p = sbuf_get(ev->record) + start; *p; p++) {
+        if (*p == '\t' || *p == '\n' || *p == '\r')
+            *p = ' ';
+    }
+    sbuf_concat(ev->record, "\n");
+}
+
+/* Hand the events collected during this batch to their subscribers. */
+void control_flush_events(void)
+{
+    struct control_event *ev;
+    struct control_client *c;
+    struct list_head *iter, *tmp;
+
+    list_for_each_safe_entry(ev, iter, tmp, &events, node) {
+        list_for_each_entry(c, &clients, node) {
+            if (!(c->events & (1UL << ev->class)))
+                continue;
+            sbuf_nconcat(c->out, sbuf_get(ev->record), ev->record->len);
+            client_drop_events(c);
+        }
+
+        list_del(&ev->node);
+        sbuf_free(ev->record);
+        free(ev);
+    }
+}
+
+/*
+ * Fill in pfd with the descriptors to watch and return how many there are. It
+ * needs room for CONTROL_MAX_CLIENTS + 1 entries.
+ */
+int control_pollfds(struct pollfd *pfd)
+{
+    struct control_client *c;
+    int n = 0;
+
+    if (listen_fd < 0)
+        return 0;
+
+    list_for_each_entry(c, &clients, node) {
+        pfd[n].fd = c->fd;
+        pfd[n].events = 0;
+        pfd[n].revents = 0;
+        if (!c->eof && (c->events || c->out->len < CONTROL_MAX_PENDING))
+            pfd[n].events |= POLLIN;
+        if (c->out->len)
+            pfd[n].events |= POLLOUT;
+        n++;
+    }
+
+    /* Negative descriptors are ignored, so we stop accepting when full. */
+    pfd[n].fd = nclients < CONTROL_MAX_CLIENTS ? listen_fd : -1;
+    pfd[n].events = POLLIN;
+    pfd[n].revents = 0;
+
+    return n + 1;
+}
+
+/* Handle whatever poll() found on the descriptors control_pollfds() gave. */
+void control_dispatch(struct pollfd *pfd, int n)
+{
+    struct control_client *c;
+    struct list_head *iter, *tmp;
+    int i = 0, drop;
+
+    if (n == 0)
+        return;
+
+    list_for_each_safe_entry(c, iter, tmp, &clients, node) {
+        if (i >= n - 1 || pfd[i].fd != c->fd)
+            break;
+
+        drop = 0;
+        if (pfd[i].revents & POLLNVAL)
+            drop = 1;
+        else if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+            drop = client_read(c) < 0;
+
+        /* Try replying straight away, it usually fits. */
+        if (!drop)
+            drop = client_write(c) < 0;
+
+        /* Done once it has hung up and has all its replies. */
+        if (drop || (c->eof && c->out->len == 0))
+            client_free(c);
+        i++;
+    }
+
+    if (pfd[n - 1].revents & POLLIN)
+        control_accept();
+}
+
+void free_control(void)
+{
+    struct control_client *c;
+    struct list_head *iter, *tmp;
+
+    /* Give subscribers a last chance to hear about the quit. */
+    control_flush_events();
+    list_for_each_safe_entry(c, iter, tmp, &clients, node) {
+        client_write(c);
+        client_free(c);
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+        listen_fd = -1;
+    }
+    free(socket_path);
+    socket_path = NULL;
+}
@@ -109,6 +109,10 @@ rp_input_line *input_line_new(char *prompt, char *preinput,
     line->buffer[length] = '\0';
     line->position = line->length = length;
 
+    line->drawn = NULL;
+    line->drawn_length = line->drawn_position = 0;
+    line->drawn_width = 0;
+
     return line;
 }
 
@@ -116,6 +120,7 @@ void input_line_free(rp_input_line *line)
 {
     completions_free(line->compl);
     free(line->buffer);
+    free(line->drawn);
     free(line);
 }
 
@@ -81,20 +81,18 @@ void show_rudeness_msg(rp_window *win, int raised)
 
 static void new_window(XCreateWindowEvent *e)
 {
-    rp_window *win;
-
     if (e->override_redirect)
         return;
 
     if (is_rp_window(e->window))
         return;
 
-    win = find_window(e->window);
-    if (win == NULL) {
-        /* We'll figure out which vscreen to put this window in later */
-        win = add_to_window_list(rp_current_screen, e->window);
-    }
-    update_window_information(win);
+    /*
+     * We'll figure out which vscreen to put this window in later. Adding
+     * it reads everything we need to know about it.
+     */
+    if (find_window(e->window) == NULL)
+        add_to_window_list(rp_current_screen, e->window);
 
     PRINT_DEBUG(("created new window\n"));
 }
@@ -286,6 +284,8 @@ static void destroy_window(XDestroyWindowEvent *ev)
 {
     rp_window *win;
 
+    forget_window_type(ev->window);
+
     win = find_window(ev->window);
     if (win == NULL)
         return;
@@ -545,12 +545,15 @@ static void handle_key(KeySym ks, unsigned int mod, rp_screen *s)
      * Read a key and execute the command associated with it on the default
      * keymap. Ignore the key if it doesn't have a binding.
      */
-    if ((key_action = find_keybinding(ks, x11_mask_to_rp_mask(mod), map))) {
+    key_action = find_keybinding(ks, x11_mask_to_rp_mask(mod), map);
+    latency_mark(LAT_LOOKUP);
+    if (key_action) {
         cmdret *result;
 
         PRINT_DEBUG(("%s\n", key_action->data));
 
-        result = command(1, key_action->data);
+        latency_mark(LAT_DISPATCH);
+        result = command_run(1, key_action->compiled);
 
         if (result) {
             if (result->output)
@@ -574,6 +577,7 @@ static void key_press(XEvent *ev)
 
     modifier = ev->xkey.state;
     cook_keycode(&ev->xkey, &ks, &modifier, NULL, 0, 1);
+    latency_mark(LAT_COOKED);
 
     handle_key(ks, modifier, s);
 }
@@ -597,14 +601,22 @@ static void property_notify(XEvent *ev)
                  ev->xproperty.state));
 
     win = find_window(ev->xproperty.window);
-    if (!win)
+    if (!win) {
+        /* An unmanaged top level we are watching for its type and name. */
+        if (ev->xproperty.atom == _net_wm_window_type ||
+            ev->xproperty.atom == XA_WM_NAME ||
+            ev->xproperty.atom == _net_wm_name)
+            forget_window_type(ev->xproperty.window);
         return;
+    }
 
-    if (ev->xproperty.atom == _net_wm_pid) {
+    if (ev->xproperty.atom == _net_wm_pid ||
+        ev->xproperty.atom == XA_WM_CLIENT_MACHINE) {
         struct rp_child_info *child_info;
 
         PRINT_DEBUG(("updating _NET_WM_PID\n"));
-        child_info = get_child_info(win->w, 1);
+        win->pid_cached = 0;
+        child_info = get_child_info(win, 1);
         if (child_info && !child_info->window_mapped) {
             if (child_info->frame) {
                 PRINT_DEBUG(("frame=%p\n", child_info->frame));
@@ -616,11 +628,13 @@ static void property_notify(XEvent *ev)
                 child_info->window_mapped = 1;
             }
         }
-    } else if (ev->xproperty.atom == XA_WM_NAME) {
+    } else if (ev->xproperty.atom == XA_WM_NAME ||
+               ev->xproperty.atom == _net_wm_name ||
+               ev->xproperty.atom == XA_WM_CLASS) {
         PRINT_DEBUG(("updating window name\n"));
         if (update_window_name(win)) {
             update_window_names(win->vscreen->screen, defaults.window_fmt);
-            hook_run(&rp_title_changed_hook);
+            hook_run_window(&rp_title_changed_hook, win);
         }
     } else if (ev->xproperty.atom == XA_WM_NORMAL_HINTS) {
         PRINT_DEBUG(("updating window normal hints\n"));
@@ -635,8 +649,7 @@ static void property_notify(XEvent *ev)
         update_window_protocols(win);
     } else if (ev->xproperty.atom == XA_WM_TRANSIENT_FOR) {
         PRINT_DEBUG(("Transient for\n"));
-        win->transient = XGetTransientForHint(dpy, win->w,
-                                              &win->transient_for);
+        update_window_transient(win);
     } else if (ev->xproperty.atom == _net_wm_state) {
         check_state(win);
     } else if (ev->xproperty.atom == _net_wm_window_type) {
@@ -645,6 +658,7 @@ static void property_notify(XEvent *ev)
          * Check if this window should now be unmanaged or managed.
          */
         PRINT_DEBUG(("_NET_WM_WINDOW_TYPE changed\n"));
+        update_window_type(win);
         if (is_unmanaged_window_type(win->w)) {
             PRINT_DEBUG(("Window type changed to unmanaged type, unmanaging\n"));
             unmanage(win);
@@ -689,6 +703,10 @@ static void focus_change(XFocusChangeEvent *ev)
     if (ev->mode != NotifyGrab)
         return;
 
+    /* Grabs on the root window survive the client's own grabs. */
+    if (defaults.root_key_grab)
+        return;
+
     win = find_window(ev->window);
 
     if (win != NULL) {
@@ -797,6 +815,8 @@ static void delegate_event(XEvent *ev)
     if (rp_have_xrandr)
         xrandr_notify(ev);
 
+    stacking_notify(ev);
+
     /* Handle Shape extension events */
     if (rp_have_shape && ev->type == rp_shape_event_base + ShapeNotify) {
         PRINT_DEBUG(("--- Handling ShapeNotify ---\n"));
@@ -963,7 +983,9 @@ static void handle_signals(void)
 /* The main loop. */
 void listen_for_events(void)
 {
-    struct pollfd pfd[1];
+    /* The X connection, then the command socket and its clients. */
+    struct pollfd pfd[CONTROL_MAX_CLIENTS + 2];
+    int n;
 
     memset(&pfd, 0, sizeof(pfd));
     pfd[0].fd = ConnectionNumber(dpy);
@@ -972,16 +994,24 @@ void listen_for_events(void)
     /* Loop forever. */
     for (;;) {
         handle_signals();
+        xrandr_settle();
 
         if (!XPending(dpy)) {
-            poll(pfd, 1, -1);
+            control_flush_events();
+            n = control_pollfds(pfd + 1);
+            if (poll(pfd, n + 1, xrandr_settle_timeout()) > 0)
+                control_dispatch(pfd + 1, n);
 
             if (!XPending(dpy))
                 continue;
         }
 
         XNextEvent(dpy, &rp_current_event);
+        latency_begin(&rp_current_event);
         delegate_event(&rp_current_event);
+        latency_mark(LAT_HANDLED);
         XSync(dpy, False);
+        latency_mark(LAT_FLUSHED);
+        latency_end();
     }
 }
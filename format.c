@@ -49,93 +49,387 @@ struct fmt_item {
 
     /* Callback to return the expanded string. */
     void (*fmt_fn)(rp_window_elem *, struct sbuf *);
+
+    /*
+     * Whether the expansion only depends on the window, so it can be
+     * remembered until format_invalidate is called on it.
+     */
+    int memo;
 };
 
 struct fmt_item fmt_items[] = {
-    { 'a', fmt_resname },
-    { 'g', fmt_gravity },
-    { 'h', fmt_height },
-    { 'H', fmt_incheight },
-    { 'c', fmt_resclass },
-    { 'f', fmt_framenum },
-    { 'i', fmt_windowid },
-    { 'l', fmt_lastaccess },
-    { 'M', fmt_maxsize },
-    { 'n', fmt_number },
-    { 'p', fmt_pid },
-    { 's', fmt_status },
-    { 'S', fmt_screen },
-    { 't', fmt_name },
-    { 'T', fmt_transient },
-    { 'w', fmt_width },
-    { 'W', fmt_incwidth },
-    { 'x', fmt_xrandrscreen },
-    { 0, NULL }
+    { 'a', fmt_resname, 1 },
+    { 'g', fmt_gravity, 1 },
+    { 'h', fmt_height, 1 },
+    { 'H', fmt_incheight, 1 },
+    { 'c', fmt_resclass, 1 },
+    { 'f', fmt_framenum, 0 },
+    { 'i', fmt_windowid, 1 },
+    { 'l', fmt_lastaccess, 0 },
+    { 'M', fmt_maxsize, 1 },
+    { 'n', fmt_number, 0 },
+    { 'p', fmt_pid, 0 },
+    { 's', fmt_status, 0 },
+    { 'S', fmt_screen, 0 },
+    { 't', fmt_name, 1 },
+    { 'T', fmt_transient, 1 },
+    { 'w', fmt_width, 1 },
+    { 'W', fmt_incwidth, 1 },
+    { 'x', fmt_xrandrscreen, 0 },
+    { 0, NULL, 0 }
 };
 
-void
-format_string(char *fmt, rp_window_elem *win_elem, struct sbuf *buffer)
+/* One step of a compiled format: a run of literal text or an escape. */
+struct fmt_op {
+    char *text;
+    int len;
+
+    struct fmt_item *item;
+    int width;
+};
+
+struct rp_format {
+    char *fmt;
+    unsigned int id;
+    struct fmt_op *ops;
+    int nops;
+
+    /* Does any op expand to something we can remember per window? */
+    int memo;
+
+    /* Most recently used first. */
+    struct list_head node;
+};
+
+/*
+ * A window's expansions of the memoizable escapes in one format, valid while
+ * the window's generation and geometry stay the same.
+ */
+struct rp_format_memo {
+    unsigned int format_id;
+    unsigned int generation, global_generation;
+    int width, height, gravity;
+
+    /* Indexed like the format's ops, NULL until expanded. */
+    char **fields;
+    int nfields;
+
+    struct rp_format_memo *next;
+};
+
+/* Compiled formats are kept for the strings used most recently. */
+#define FORMAT_CACHE_SIZE 16
+
+/* Windows remember expansions of this many formats. */
+#define FORMAT_MEMOS 4
+
+static LIST_HEAD(formats);
+static int nformats = 0;
+static unsigned int next_format_id = 1;
+
+/* Bumped when something every window's expansion depends on changes. */
+static unsigned int global_generation = 0;
+
+/* Bumped when the focused window or vscreen may have changed. */
+static unsigned int focus_generation = 0;
+
+static void format_free(rp_format *prog)
+{
+    int i;
+
+    for (i = 0; i < prog->nops; i++)
+        free(prog->ops[i].text);
+    free(prog->ops);
+    free(prog->fmt);
+    free(prog);
+}
+
+static void format_add_text(rp_format *prog, char *text, int len)
+{
+    struct fmt_op *op;
+
+    /* Runs of plain characters become one op. */
+    if (prog->nops > 0 && prog->ops[prog->nops - 1].text) {
+        op = &prog->ops[prog->nops - 1];
+        op->text = xrealloc(op->text, op->len + len + 1);
+        memcpy(op->text + op->len, text, len);
+        op->len += len;
+        op->text[op->len] = '\0';
+        return;
+    }
+
+    prog->ops = xrealloc(prog->ops, sizeof(struct fmt_op) * (prog->nops + 1));
+    op = &prog->ops[prog->nops++];
+    op->text = xmalloc(len + 1);
+    memcpy(op->text, text, len);
+    op->text[len] = '\0';
+    op->len = len;
+    op->item = NULL;
+    op->width = -1;
+}
+
+static void format_add_item(rp_format *prog, struct fmt_item *item, int width)
+{
+    struct fmt_op *op;
+
+    prog->ops = xrealloc(prog->ops, sizeof(struct fmt_op) * (prog->nops + 1));
+    op = &prog->ops[prog->nops++];
+    op->text = NULL;
+    op->len = 0;
+    op->item = item;
+    op->width = width;
+
+    if (item->memo)
+        prog->memo = 1;
+}
+
+/*
+ * Return the compiled form of fmt, compiling it if it isn't one of the
+ * recently used formats.
+ */
+rp_format *format_compile(char *fmt)
 {
 #define STATE_READ   0
 #define STATE_NUMBER 1
 #define STATE_ESCAPE 2
     int state = STATE_READ;
-    char dbuf[10];
     int width = -1;
-    struct sbuf *retbuf;
+    rp_format *prog;
+    char *p, pct[2];
     int fip, found;
 
-    retbuf = sbuf_new(0);
+    list_for_each_entry(prog, &formats, node) {
+        if (strcmp(prog->fmt, fmt) == 0) {
+            list_del(&prog->node);
+            list_add(&prog->node, &formats);
+            return prog;
+        }
+    }
+
+    prog = xmalloc(sizeof(rp_format));
+    prog->fmt = xstrdup(fmt);
+    prog->id = next_format_id++;
+    prog->ops = NULL;
+    prog->nops = 0;
+    prog->memo = 0;
 
-    for (; *fmt; fmt++) {
-        if (*fmt == '%' && state == STATE_READ) {
+    for (p = fmt; *p; p++) {
+        if (*p == '%' && state == STATE_READ) {
             state = STATE_ESCAPE;
             continue;
         }
         if ((state == STATE_ESCAPE || state == STATE_NUMBER) &&
-            isdigit(*fmt)) {
+            isdigit((unsigned char) *p)) {
             /* Accumulate the width one digit at a time. */
             if (state == STATE_ESCAPE)
                 width = 0;
             width *= 10;
-            width += *fmt - '0';
+            width += *p - '0';
             state = STATE_NUMBER;
             continue;
         }
         found = 0;
         if (state == STATE_ESCAPE || state == STATE_NUMBER) {
-            if (*fmt == '%')
-                sbuf_concat(buffer, "%");
+            if (*p == '%')
+                format_add_text(prog, "%", 1);
             else {
                 for (fip = 0; fmt_items[fip].fmt_char; fip++) {
-                    if (fmt_items[fip].fmt_char == *fmt) {
-                        sbuf_clear(retbuf);
-                        fmt_items[fip].fmt_fn(win_elem, retbuf);
-                        sbuf_utf8_nconcat(buffer, sbuf_get(retbuf), width);
+                    if (fmt_items[fip].fmt_char == *p) {
+                        format_add_item(prog, &fmt_items[fip], width);
                         found = 1;
                         break;
                     }
                 }
+                /* An unknown escape ends the format. */
                 if (!found) {
-                    sbuf_printf_concat(buffer, "%%%c", *fmt);
+                    pct[0] = '%';
+                    pct[1] = *p;
+                    format_add_text(prog, pct, 2);
                     break;
                 }
             }
             state = STATE_READ;
             width = -1;
         } else {
-            /* Insert the character. */
-            dbuf[0] = *fmt;
-            dbuf[1] = 0;
-            sbuf_concat(buffer, dbuf);
+            format_add_text(prog, p, 1);
         }
     }
-    sbuf_free(retbuf);
+
+    list_add(&prog->node, &formats);
+    if (++nformats > FORMAT_CACHE_SIZE) {
+        rp_format *last = list_entry(formats.prev, rp_format, node);
+
+        list_del(&last->node);
+        format_free(last);
+        nformats--;
+    }
+
+    return prog;
 #undef STATE_READ
 #undef STATE_ESCAPE
 #undef STATE_NUMBER
 }
 
+static void memo_clear(struct rp_format_memo *memo)
+{
+    int i;
+
+    for (i = 0; i < memo->nfields; i++) {
+        free(memo->fields[i]);
+        memo->fields[i] = NULL;
+    }
+}
+
+static void memo_free(struct rp_format_memo *memo)
+{
+    memo_clear(memo);
+    free(memo->fields);
+    free(memo);
+}
+
+/* Find win's expansions for prog, throwing them away if they are stale. */
+static struct rp_format_memo *format_memo(rp_format *prog, rp_window *win)
+{
+    struct rp_format_memo *memo, **prev;
+    int n;
+
+    for (prev = &win->fmt_memo; (memo = *prev); prev = &memo->next) {
+        if (memo->format_id == prog->id) {
+            *prev = memo->next;
+            break;
+        }
+    }
+
+    if (memo == NULL) {
+        memo = xmalloc(sizeof(struct rp_format_memo));
+        memo->format_id = prog->id;
+        memo->nfields = prog->nops;
+        memo->fields = xmalloc(sizeof(char *) * prog->nops);
+        memset(memo->fields, 0, sizeof(char *) * prog->nops);
+        memo->generation = win->fmt_generation;
+        memo->global_generation = global_generation;
+        memo->width = win->width;
+        memo->height = win->height;
+        memo->gravity = win->gravity;
+    }
+
+    /* Keep the most recently used first, and only a few of them. */
+    memo->next = win->fmt_memo;
+    win->fmt_memo = memo;
+    for (n = 1, prev = &memo->next; *prev; n++, prev = &(*prev)->next) {
+        if (n == FORMAT_MEMOS) {
+            struct rp_format_memo *rest = *prev;
+
+            *prev = NULL;
+            while (rest) {
+                struct rp_format_memo *next = rest->next;
+
+                memo_free(rest);
+                rest = next;
+            }
+            break;
+        }
+    }
+
+    if (memo->generation != win->fmt_generation
+        || memo->global_generation != global_generation
+        || memo->width != win->width || memo->height != win->height
+        || memo->gravity != win->gravity) {
+        memo_clear(memo);
+        memo->generation = win->fmt_generation;
+        memo->global_generation = global_generation;
+        memo->width = win->width;
+        memo->height = win->height;
+        memo->gravity = win->gravity;
+    }
+
+    return memo;
+}
+
+void format_run(rp_format *prog, rp_window_elem *win_elem, struct sbuf *buffer)
+{
+    struct rp_format_memo *memo = NULL;
+    struct sbuf *retbuf, *field;
+    struct fmt_op *op;
+    int i;
+
+    if (prog->memo)
+        memo = format_memo(prog, win_elem->win);
+
+    retbuf = sbuf_new(0);
+
+    for (i = 0; i < prog->nops; i++) {
+        op = &prog->ops[i];
+
+        if (op->text) {
+            sbuf_nconcat(buffer, op->text, op->len);
+        } else if (memo && op->item->memo) {
+            if (memo->fields[i] == NULL) {
+                sbuf_clear(retbuf);
+                op->item->fmt_fn(win_elem, retbuf);
+                field = sbuf_new(0);
+                sbuf_utf8_nconcat(field, sbuf_get(retbuf), op->width);
+                memo->fields[i] = sbuf_free_struct(field);
+            }
+            sbuf_concat(buffer, memo->fields[i]);
+        } else {
+            sbuf_clear(retbuf);
+            op->item->fmt_fn(win_elem, retbuf);
+            sbuf_utf8_nconcat(buffer, sbuf_get(retbuf), op->width);
+        }
+    }
+
+    sbuf_free(retbuf);
+}
+
+void
+format_string(char *fmt, rp_window_elem *win_elem, struct sbuf *buffer)
+{
+    format_run(format_compile(fmt), win_elem, buffer);
+}
+
+/* Something a memoized escape expands to changed for win. */
+void format_invalidate(rp_window *win)
+{
+    win->fmt_generation++;
+    snapshot_touch();
+}
+
+/* Something a memoized escape expands to changed for every window. */
+void format_invalidate_all(void)
+{
+    global_generation++;
+    snapshot_touch();
+}
+
+/* The focused window or vscreen may have changed. */
+void format_focus_changed(void)
+{
+    focus_generation++;
+}
+
+void format_forget_window(rp_window *win)
+{
+    struct rp_format_memo *memo;
+
+    while ((memo = win->fmt_memo)) {
+        win->fmt_memo = memo->next;
+        memo_free(memo);
+    }
+}
+
+void free_formats(void)
+{
+    rp_format *cur;
+    struct list_head *iter, *tmp;
+
+    list_for_each_safe_entry(cur, iter, tmp, &formats, node) {
+        list_del(&cur->node);
+        format_free(cur);
+    }
+    nformats = 0;
+}
+
 static void fmt_framenum(rp_window_elem *win_elem, struct sbuf *buf)
 {
     sbuf_copy(buf, "");
@@ -173,14 +467,30 @@ static void fmt_resclass(rp_window_elem *win_elem, struct sbuf *buf)
         sbuf_copy(buf, "None");
 }
 
+/*
+ * Finding the current and other window walks the window lists, so remember
+ * them for as long as focus and the snapshot generation stay put. Otherwise
+ * expanding %s for every window in a list takes time quadratic in its length.
+ */
 static void fmt_status(rp_window_elem *win_elem, struct sbuf *buf)
 {
-    rp_window *other_window;
+    static unsigned int generation;
+    static unsigned long state;
+    static rp_vscreen *vscreen = NULL;
+    static rp_window *current, *other;
+
+    if (vscreen != rp_current_vscreen || generation != focus_generation
+        || state != snapshot_generation()) {
+        vscreen = rp_current_vscreen;
+        generation = focus_generation;
+        state = snapshot_generation();
+        current = current_window();
+        other = find_window_other(vscreen);
+    }
 
-    other_window = find_window_other(rp_current_vscreen);
-    if (win_elem->win == other_window)
+    if (win_elem->win == other)
         sbuf_copy(buf, "+");
-    else if (win_elem->win == current_window())
+    else if (win_elem->win == current)
         sbuf_copy(buf, "*");
     else
         sbuf_copy(buf, "-");
@@ -255,7 +565,7 @@ static void fmt_pid(rp_window_elem *elem, struct sbuf *buf)
 {
     struct rp_child_info *info;
 
-    info = get_child_info(elem->win->w, 0);
+    info = get_child_info(elem->win, 0);
     if (info)
         sbuf_printf_concat(buf, "%d", info->pid);
     else
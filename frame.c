@@ -76,26 +76,52 @@ int frame_height(rp_frame *frame)
     return frame->height;
 }
 
+int frame_side(rp_frame *frame, int side)
+{
+    switch (side) {
+    case SIDE_TOP:
+        return frame_top(frame);
+    case SIDE_LEFT:
+        return frame_left(frame);
+    case SIDE_RIGHT:
+        return frame_right(frame);
+    default:
+        return frame_bottom(frame);
+    }
+}
+
 void frame_resize_left(rp_frame *frame, int amount)
 {
+    int old = frame_left(frame);
+
     frame->x -= amount;
     frame->width += amount;
+    frame_side_moved(frame, SIDE_LEFT, old);
 }
 
 void frame_resize_right(rp_frame *frame, int amount)
 {
+    int old = frame_right(frame);
+
     frame->width += amount;
+    frame_side_moved(frame, SIDE_RIGHT, old);
 }
 
 void frame_resize_up(rp_frame *frame, int amount)
 {
+    int old = frame_top(frame);
+
     frame->y -= amount;
     frame->height += amount;
+    frame_side_moved(frame, SIDE_TOP, old);
 }
 
 void frame_resize_down(rp_frame *frame, int amount)
 {
+    int old = frame_bottom(frame);
+
     frame->height += amount;
+    frame_side_moved(frame, SIDE_BOTTOM, old);
 }
 
 void mark_edge_frames(void)
@@ -133,6 +159,7 @@ static void init_frame(rp_frame *f)
     f->last_access = 0;
     f->dedicated = 0;
     f->restore_win_number = EMPTY;
+    f->split = NULL;
 }
 
 rp_frame *frame_new(rp_vscreen *v)
@@ -149,6 +176,8 @@ rp_frame *frame_new(rp_vscreen *v)
 
 void frame_free(rp_vscreen *v, rp_frame *f)
 {
+    frames_changed(v);
+    frame_windows_changed(v);
     numset_release(v->frames_numset, f->number);
     free(f);
 }
@@ -167,6 +196,7 @@ rp_frame *frame_copy(rp_frame *frame)
     copy->height = frame->height;
     copy->win_number = frame->win_number;
     copy->last_access = frame->last_access;
+    copy->split = NULL;
 
     return copy;
 }
@@ -193,27 +223,81 @@ char *frame_dump(rp_frame *frame, rp_vscreen *vscreen)
                 win ? win->w : 0, frame->last_access, frame->dedicated);
 
     /* Extract the string and return it, and don't forget to free s. */
-    tmp = sbuf_get(s);
-    free(s);
+    tmp = sbuf_free_struct(s);
     return tmp;
 }
 
+/* Make a blank frame for vscreen, to be filled in and passed to frame_fit. */
+rp_frame *frame_make(rp_vscreen *vscreen)
+{
+    rp_frame *f;
+
+    f = xmalloc(sizeof(rp_frame));
+    init_frame(f);
+    f->vscreen = vscreen;
+
+    return f;
+}
+
+/*
+ * Finish a frame read back from a dump of a screen s_width by s_height
+ * pixels, showing the X11 window w.
+ */
+void frame_fit(rp_frame *f, int s_width, int s_height, Window w)
+{
+    rp_vscreen *vscreen = f->vscreen;
+    rp_window *win;
+
+    /* adjust x, y, width and height to a possible screen size change */
+    if (s_width > 0) {
+        f->x = (f->x * vscreen->screen->width) / s_width;
+        f->width = (f->width * vscreen->screen->width) / s_width;
+    }
+    if (s_height > 0) {
+        f->y = (f->y * vscreen->screen->height) / s_height;
+        f->height = (f->height * vscreen->screen->height) / s_height;
+    }
+    /*
+     * Perform some integrity checks on what we got and fix any problems.
+     */
+    if (f->number <= 0)
+        f->number = 0;
+    if (f->x <= 0)
+        f->x = 0;
+    if (f->y <= 0)
+        f->y = 0;
+    if (f->width <=
+        (defaults.window_border_width * 2) + (defaults.gap * 2))
+        f->width =
+            (defaults.window_border_width * 2) + (defaults.gap * 2) + 1;
+    if (f->height <=
+        (defaults.window_border_width * 2) + (defaults.gap * 2))
+        f->height =
+            (defaults.window_border_width * 2) + (defaults.gap * 2) + 1;
+    if (f->last_access < 0)
+        f->last_access = 0;
+
+    /* Find the window with the X11 window ID. */
+    win = find_window_in_list(w, &rp_mapped_window);
+    if (win)
+        f->win_number = win->number;
+    else
+        f->win_number = EMPTY;
+}
+
 /* Used only by frame_read */
 #define read_slot(x) do { tmp = strtok_ws (NULL); x = strtol(tmp,NULL,10); } while(0)
 
 rp_frame *frame_read(char *str, rp_vscreen *vscreen)
 {
     Window w = 0L;
-    rp_window *win;
     rp_frame *f;
     char *tmp, *d;
     int s_width = -1;
     int s_height = -1;
 
     /* Create a blank frame. */
-    f = xmalloc(sizeof(rp_frame));
-    init_frame(f);
-    f->vscreen = vscreen;
+    f = frame_make(vscreen);
 
     PRINT_DEBUG(("parsing '%s'\n", str));
 
@@ -269,41 +353,7 @@ rp_frame *frame_read(char *str, rp_vscreen *vscreen)
         warnx("frame has trailing garbage: %s", tmp);
     free(d);
 
-    /* adjust x, y, width and height to a possible screen size change */
-    if (s_width > 0) {
-        f->x = (f->x * vscreen->screen->width) / s_width;
-        f->width = (f->width * vscreen->screen->width) / s_width;
-    }
-    if (s_height > 0) {
-        f->y = (f->y * vscreen->screen->height) / s_height;
-        f->height = (f->height * vscreen->screen->height) / s_height;
-    }
-    /*
-     * Perform some integrity checks on what we got and fix any problems.
-     */
-    if (f->number <= 0)
-        f->number = 0;
-    if (f->x <= 0)
-        f->x = 0;
-    if (f->y <= 0)
-        f->y = 0;
-    if (f->width <=
-        (defaults.window_border_width * 2) + (defaults.gap * 2))
-        f->width =
-            (defaults.window_border_width * 2) + (defaults.gap * 2) + 1;
-    if (f->height <=
-        (defaults.window_border_width * 2) + (defaults.gap * 2))
-        f->height =
-            (defaults.window_border_width * 2) + (defaults.gap * 2) + 1;
-    if (f->last_access < 0)
-        f->last_access = 0;
-
-    /* Find the window with the X11 window ID. */
-    win = find_window_in_list(w, &rp_mapped_window);
-    if (win)
-        f->win_number = win->number;
-    else
-        f->win_number = EMPTY;
+    frame_fit(f, s_width, s_height, w);
 
     return f;
 }
@@ -359,6 +359,7 @@ XftFont *rp_get_font(rp_screen *s, char *font)
     /* free up the last slot if needed */
     if (x == fslots) {
         free(s->xft_font_cache[x - 1].name);
+        flush_glyph_cache(s);
         XftFontClose(dpy, s->xft_font_cache[x - 1].font);
     }
 
@@ -377,6 +378,8 @@ void rp_clear_cached_fonts(rp_screen *s)
 {
     size_t x;
 
+    flush_glyph_cache(s);
+
     for (x = 0; x < (sizeof(s->xft_font_cache) / sizeof(struct rp_font));
          x++) {
         if (s->xft_font_cache[x].name) {
@@ -386,17 +389,283 @@ void rp_clear_cached_fonts(rp_screen *s)
     }
 }
 
+static unsigned int glyph_hash(XftFont *font, char *string, int length)
+{
+    unsigned int h = 2166136261u ^ (unsigned int) (unsigned long) font;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        h ^= (unsigned char) string[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static void glyph_run_free(rp_screen *s, struct rp_glyph_run *run)
+{
+    struct rp_glyph_run **p;
+
+    for (p = &s->glyph_buckets[run->hash % GLYPH_CACHE_BUCKETS]; *p;
+         p = &(*p)->next) {
+        if (*p == run) {
+            *p = run->next;
+            break;
+        }
+    }
+
+    list_del(&run->lru);
+    s->glyph_count--;
+    free(run->string);
+    free(run->glyphs);
+    free(run);
+}
+
+/* Drop every glyph run, such as when a font is closed. */
+void flush_glyph_cache(rp_screen *s)
+{
+    struct rp_glyph_run *cur;
+    struct list_head *iter, *tmp;
+
+    if (s->glyph_lru.next == NULL)
+        return;
+
+    list_for_each_safe_entry(cur, iter, tmp, &s->glyph_lru, lru)
+        glyph_run_free(s, cur);
+}
+
+/*
+ * Look up the glyphs for the first length bytes of string in font, making
+ * them if they aren't cached.
+ */
+static struct rp_glyph_run *glyph_run(rp_screen *s, XftFont *font,
+                                      char *string, int length)
+{
+    struct rp_glyph_run *run;
+    XGlyphInfo extents;
+    unsigned int hash;
+    FcChar32 ucs4;
+    int i, n;
+
+    hash = glyph_hash(font, string, length);
+    for (run = s->glyph_buckets[hash % GLYPH_CACHE_BUCKETS]; run;
+         run = run->next) {
+        if (run->hash == hash && run->font == font
+            && run->length == length
+            && memcmp(run->string, string, length) == 0) {
+            s->glyph_hits++;
+            list_del(&run->lru);
+            list_add(&run->lru, &s->glyph_lru);
+            return run;
+        }
+    }
+
+    s->glyph_misses++;
+
+    if (s->glyph_count >= GLYPH_CACHE_SIZE)
+        glyph_run_free(s, list_entry(s->glyph_lru.prev,
+                                     struct rp_glyph_run, lru));
+
+    run = xmalloc(sizeof(struct rp_glyph_run));
+    run->font = font;
+    run->hash = hash;
+    run->string = xmalloc(length + 1);
+    memcpy(run->string, string, length);
+    run->string[length] = '\0';
+    run->length = length;
+
+    /* There can't be more glyphs than bytes. */
+    run->glyphs = xmalloc(sizeof(FT_UInt) * (length ? length : 1));
+    run->nglyphs = 0;
+    for (i = 0; i < length; i += n) {
+        n = FcUtf8ToUcs4((FcChar8 *) string + i, &ucs4, length - i);
+        /* Stop at broken UTF-8, like XftDrawStringUtf8 does. */
+        if (n <= 0)
+            break;
+        run->glyphs[run->nglyphs++] = XftCharIndex(dpy, font, ucs4);
+    }
+
+    XftGlyphExtents(dpy, font, run->glyphs, run->nglyphs, &extents);
+    run->width = extents.xOff;
+
+    run->next = s->glyph_buckets[hash % GLYPH_CACHE_BUCKETS];
+    s->glyph_buckets[hash % GLYPH_CACHE_BUCKETS] = run;
+    list_add(&run->lru, &s->glyph_lru);
+    s->glyph_count++;
+
+    return run;
+}
+
+/* Append each screen's glyph cache hit rate. */
+void glyph_cache_stats(struct sbuf *buf)
+{
+    rp_screen *s;
+    unsigned long total;
+
+    list_for_each_entry(s, &rp_screens, node) {
+        total = s->glyph_hits + s->glyph_misses;
+        sbuf_printf_concat(buf, "screen %d glyph cache: %d runs, "
+                           "%lu hits, %lu misses (%lu%%)\n", s->number,
+                           s->glyph_count, s->glyph_hits,
+                           s->glyph_misses,
+                           total ? s->glyph_hits * 100 / total : 0);
+    }
+}
+
+/*
+ * Look up a color by name, allocating it the first time. Falls back to the
+ * foreground color if the name is bad, remembering that it is.
+ */
+static XftColor *rp_get_color(rp_screen *s, char *name)
+{
+    struct rp_color *cur;
+
+    list_for_each_entry(cur, &s->xft_colors, node) {
+        if (strcmp(cur->name, name) == 0)
+            return cur->bad ? &s->xft_fgcolor : &cur->color;
+    }
+
+    cur = xmalloc(sizeof(struct rp_color));
+    cur->name = xstrdup(name);
+    cur->bad = !XftColorAllocName(dpy, DefaultVisual(dpy, s->screen_num),
+                                  DefaultColormap(dpy, s->screen_num), name,
+                                  &cur->color);
+    list_add(&cur->node, &s->xft_colors);
+
+    if (cur->bad) {
+        warnx("couldn't XftColorAllocName \"%s\"", name);
+        return &s->xft_fgcolor;
+    }
+
+    return &cur->color;
+}
+
+void rp_free_cached_colors(rp_screen *s)
+{
+    struct rp_color *cur;
+    struct list_head *iter, *tmp;
+
+    if (s->xft_colors.next == NULL)
+        return;
+
+    list_for_each_safe_entry(cur, iter, tmp, &s->xft_colors, node) {
+        if (!cur->bad)
+            XftColorFree(dpy, DefaultVisual(dpy, s->screen_num),
+                         DefaultColormap(dpy, s->screen_num), &cur->color);
+        list_del(&cur->node);
+        free(cur->name);
+        free(cur);
+    }
+}
+
+/*
+ * Make sure the back buffer can hold width by height. It only ever grows.
+ * Returns 1 if it had to be replaced, losing what was drawn in it.
+ */
+int
+back_buffer_reserve(rp_screen *s, struct rp_back_buffer *b, int width,
+                    int height)
+{
+    XGCValues gcv;
+    Pixmap p;
+
+    if (b->pixmap != None && width <= b->width && height <= b->height)
+        return 0;
+
+    if (width < b->width)
+        width = b->width;
+    if (height < b->height)
+        height = b->height;
+
+    p = XCreatePixmap(dpy, s->root, width, height,
+                      DefaultDepth(dpy, s->screen_num));
+
+    if (b->gc == NULL) {
+        /* Copying to the window must not send us GraphicsExpose events. */
+        gcv.graphics_exposures = False;
+        b->gc = XCreateGC(dpy, s->root, GCGraphicsExposures, &gcv);
+    }
+
+    if (b->draw == NULL) {
+        b->draw = XftDrawCreate(dpy, p, DefaultVisual(dpy, s->screen_num),
+                                DefaultColormap(dpy, s->screen_num));
+        if (b->draw == NULL)
+            warnx("no Xft font available");
+    } else {
+        XftDrawChange(b->draw, p);
+    }
+
+    if (b->pixmap != None)
+        XFreePixmap(dpy, b->pixmap);
+    b->pixmap = p;
+    b->width = width;
+    b->height = height;
+
+    return 1;
+}
+
+void back_buffer_free(struct rp_back_buffer *b)
+{
+    if (b->draw)
+        XftDrawDestroy(b->draw);
+    if (b->gc)
+        XFreeGC(dpy, b->gc);
+    if (b->pixmap != None)
+        XFreePixmap(dpy, b->pixmap);
+    memset(b, 0, sizeof(*b));
+}
+
+/* The screen's long lived XftDraw for d, if it has one. */
+static XftDraw *rp_screen_draw(rp_screen *s, Drawable d)
+{
+    if (d == s->input_buf.pixmap)
+        return s->input_buf.draw;
+    if (d == s->frame_window)
+        return s->frame_draw;
+    if (d == s->help_window)
+        return s->help_draw;
+    if (d == s->bar_buf.back.pixmap)
+        return s->bar_buf.back.draw;
+
+    return NULL;
+}
+
+/* Draw a string with an XftDraw the caller keeps around. */
 void
-rp_draw_string(rp_screen *s, Drawable d, int style, int x, int y,
-               char *string, int length, char *font, char *color)
+rp_draw_string_on(rp_screen *s, XftDraw *draw, int style, int x, int y,
+                  char *string, int length, char *font, char *color)
 {
-    XftDraw *draw;
-    XftColor xftcolor;
+    struct rp_glyph_run *run;
+    XftColor *xftcolor;
     XftFont *f = rp_get_font(s, font);
 
     if (length < 0)
         length = strlen(string);
 
+    if (color != NULL)
+        xftcolor = rp_get_color(s, color);
+    else if (style == STYLE_NORMAL)
+        xftcolor = &s->xft_fgcolor;
+    else
+        xftcolor = &s->xft_bgcolor;
+
+    run = glyph_run(s, f, string, length);
+    XftDrawGlyphs(draw, xftcolor, f, x, y, run->glyphs, run->nglyphs);
+}
+
+void
+rp_draw_string(rp_screen *s, Drawable d, int style, int x, int y,
+               char *string, int length, char *font, char *color)
+{
+    XftDraw *draw;
+
+    if ((draw = rp_screen_draw(s, d))) {
+        rp_draw_string_on(s, draw, style, x, y, string, length, font,
+                          color);
+        return;
+    }
+
+    /* Some short lived window, such as the frame numbers. */
     draw = XftDrawCreate(dpy, d, DefaultVisual(dpy, s->screen_num),
                          DefaultColormap(dpy, s->screen_num));
     if (!draw) {
@@ -404,40 +673,18 @@ rp_draw_string(rp_screen *s, Drawable d, int style, int x, int y,
         return;
     }
 
-    if (color == NULL) {
-        if (style == STYLE_NORMAL)
-            memcpy(&xftcolor, &s->xft_fgcolor, sizeof(XftColor));
-        else
-            memcpy(&xftcolor, &s->xft_bgcolor, sizeof(XftColor));
-    } else {
-        /*
-         * This won't actually allocate anything if the color is
-         * already allocated.
-         */
-        if (!XftColorAllocName(dpy, DefaultVisual(dpy, s->screen_num),
-                               DefaultColormap(dpy, s->screen_num), color,
-                               &xftcolor)) {
-            warnx("couldn't XftColorAllocName \"%s\"", color);
-            memcpy(&xftcolor, &s->xft_fgcolor, sizeof(XftColor));
-        }
-    }
-
-    XftDrawStringUtf8(draw, &xftcolor, f, x, y, (FcChar8 *) string,
-                      length);
+    rp_draw_string_on(s, draw, style, x, y, string, length, font, color);
     XftDrawDestroy(draw);
 }
 
 int rp_text_width(rp_screen *s, char *string, int count, char *font)
 {
-    XGlyphInfo extents;
     XftFont *f = rp_get_font(s, font);
 
     if (count < 0)
         count = strlen(string);
 
-    XftTextExtentsUtf8(dpy, f, (FcChar8 *) string, count, &extents);
-
-    return extents.xOff;
+    return glyph_run(s, f, string, count)->width;
 }
 
 /* A case insensitive strncmp. */
@@ -608,6 +855,9 @@ void clean_up(void)
     free_user_commands();
     free_bar();
     free_window_stuff();
+    free_formats();
+    free_control();
+    free_snapshot();
 
     list_for_each_safe_entry(cur, iter, tmp, &rp_screens, node) {
         list_for_each_safe_entry(vcur, iter2, tmp2, &cur->vscreens, node)
@@ -17,50 +17,64 @@
  */
 
 /*
- * A hook is simply a list of strings that get passed to command() in sequence.
+ * A hook is simply a list of commands that get run in sequence. Each one is
+ * compiled when it is added, so running the hook doesn't parse them again.
  */
 
 #include "poison.h"
 
 #include <string.h>
 
-void hook_add(struct list_head *hook, struct sbuf *s)
+void hook_add(struct list_head *hook, char *cmd)
 {
-    struct sbuf *cur;
+    struct rp_hook_cmd *cur;
 
     /* Check if it's in the list already. */
     list_for_each_entry(cur, hook, node) {
-        if (!strcmp(sbuf_get(cur), sbuf_get(s))) {
-            sbuf_free(s);
+        if (!strcmp(cur->cmd, cmd))
             return;
-        }
     }
 
     /* It's not in the list, so add it. */
-    list_add_tail(&s->node, hook);
+    cur = xmalloc(sizeof(struct rp_hook_cmd));
+    cur->cmd = xstrdup(cmd);
+    cur->compiled = command_compile(cmd);
+    list_add_tail(&cur->node, hook);
 }
 
-void hook_remove(struct list_head *hook, struct sbuf *s)
+void hook_remove(struct list_head *hook, char *cmd)
 {
     struct list_head *tmp, *iter;
-    struct sbuf *cur;
+    struct rp_hook_cmd *cur;
 
     /* If it's in the list, delete it. */
     list_for_each_safe_entry(cur, iter, tmp, hook, node) {
-        if (!strcmp(sbuf_get(cur), sbuf_get(s))) {
+        if (!strcmp(cur->cmd, cmd)) {
             list_del(&cur->node);
-            sbuf_free(cur);
+            command_compiled_free(cur->compiled);
+            free(cur->cmd);
+            free(cur);
         }
     }
 }
 
 void hook_run(struct list_head *hook)
 {
-    struct sbuf *cur;
+    hook_run_window(hook, NULL);
+}
+
+/* Run a hook about win, rather than about the current window. */
+void hook_run_window(struct list_head *hook, rp_window *win)
+{
+    struct rp_hook_cmd *cur;
     cmdret *result;
 
+    control_event(hook, win);
+    if (hook != &rp_key_hook)
+        snapshot_touch();
+
     list_for_each_entry(cur, hook, node) {
-        result = command(1, sbuf_get(cur));
+        result = command_run(1, cur->compiled);
         if (result) {
             if (result->output)
                 message(result->output);
@@ -348,13 +348,13 @@ void read_any_key(void)
     unsigned int mod;
     KeySym c;
 
-    read_single_key(&c, &mod, buffer, sizeof(buffer));
+    read_single_key(&c, &mod, buffer, sizeof(buffer), 0);
 }
 
 /* The same as read_key, but handle focusing the key_window and reverting focus. */
 int
 read_single_key(KeySym *keysym, unsigned int *modifiers, char *keysym_name,
-                int len)
+                int len, int traced)
 {
     Window focus;
     int revert;
@@ -362,36 +362,89 @@ read_single_key(KeySym *keysym, unsigned int *modifiers, char *keysym_name,
 
     XGetInputFocus(dpy, &focus, &revert);
     set_window_focus(rp_current_screen->key_window);
-    nbytes = read_key(keysym, modifiers, keysym_name, len);
+    nbytes = read_key(keysym, modifiers, keysym_name, len, traced);
     set_window_focus(focus);
 
     return nbytes;
 }
 
+/*
+ * Read a key. If traced is set, as it is for the key after the prefix, the
+ * key gets a latency sample of its own, like a key from the event loop.
+ * Prompts don't trace the keys they read.
+ */
 int
 read_key(KeySym *keysym, unsigned int *modifiers, char *keysym_name,
-         int len)
+         int len, int traced)
 {
     XEvent ev;
     int nbytes;
 
+    /*
+     * Waiting for the key isn't part of handling the event being traced,
+     * so flush what it asked for and end its sample here.
+     */
+    if (latency_enabled()) {
+        XFlush(dpy);
+        latency_mark(LAT_FLUSHED);
+    }
+    latency_end();
+
     /* Read a key from the keyboard. */
-    do {
+    for (;;) {
         XMaskEvent(dpy, KeyPressMask | KeyRelease, &ev);
+        if (traced)
+            latency_begin(&ev);
+
         *modifiers = ev.xkey.state;
         nbytes = cook_keycode(&ev.xkey, keysym, modifiers, keysym_name,
                               len, 0);
-    } while (IsModifierKey(*keysym) || ev.xkey.type == KeyRelease);
+        if (!IsModifierKey(*keysym) && ev.xkey.type != KeyRelease)
+            break;
+
+        latency_cancel();
+    }
+    latency_mark(LAT_COOKED);
 
     return nbytes;
 }
 
+/*
+ * Where the input line differs from what was drawn last: the first byte that
+ * changed or the old or new cursor position, whichever comes first.
+ */
+static size_t input_damage_start(rp_input_line *line)
+{
+    size_t start = 0;
+
+    while (start < line->length && start < line->drawn_length
+           && line->buffer[start] == line->drawn[start])
+        start++;
+
+    if (line->drawn_position < start)
+        start = line->drawn_position;
+    if (line->position < start)
+        start = line->position;
+
+    /* Don't split a character. */
+    while (start > 0 && isu8cont(line->buffer[start]))
+        start--;
+
+    return start;
+}
+
 static void update_input_window(rp_screen *s, rp_input_line *line)
 {
+    struct rp_back_buffer *b = &s->input_buf;
     int prompt_width, input_width, total_width;
-    int char_len = 0, height;
-    GC lgc;
-    XGCValues gcv;
+    int char_len = 0, height, x, full;
+    size_t start = 0;
+
+    /* Nothing moved, such as a cursor motion at the end of the line. */
+    if (line->drawn && line->length == line->drawn_length
+        && line->position == line->drawn_position
+        && memcmp(line->buffer, line->drawn, line->length) == 0)
+        return;
 
     prompt_width = rp_text_width(s, line->prompt, -1, NULL);
     input_width = rp_text_width(s, line->buffer, line->length, NULL);
@@ -409,36 +462,71 @@ static void update_input_window(rp_screen *s, rp_input_line *line)
     if (total_width < defaults.input_window_size + prompt_width)
         total_width = defaults.input_window_size + prompt_width;
 
-    XMoveResizeWindow(dpy, s->input_window,
-                      bar_x(s, total_width), bar_y(s, height), total_width,
-                      (FONT_HEIGHT(s) + defaults.bar_y_padding * 2));
+    /* While the prompt is up the window only grows, so it doesn't jitter. */
+    full = (line->drawn == NULL);
+    if (!full && total_width < line->drawn_width)
+        total_width = line->drawn_width;
 
-    XClearWindow(dpy, s->input_window);
+    if (full || total_width != line->drawn_width) {
+        XMoveResizeWindow(dpy, s->input_window,
+                          bar_x(s, total_width), bar_y(s, height),
+                          total_width, height);
+        full = 1;
+    }
 
-    rp_draw_string(s, s->input_window, STYLE_NORMAL,
-                   defaults.bar_x_padding,
-                   defaults.bar_y_padding + FONT_ASCENT(s),
-                   line->prompt, -1, NULL, NULL);
+    if (back_buffer_reserve(s, b, total_width, height))
+        full = 1;
+    if (b->draw == NULL)
+        return;
 
-    rp_draw_string(s, s->input_window, STYLE_NORMAL,
-                   defaults.bar_x_padding + prompt_width,
-                   defaults.bar_y_padding + FONT_ASCENT(s),
-                   line->buffer, line->length, NULL, NULL);
+    if (full) {
+        x = 0;
+    } else {
+        start = input_damage_start(line);
+        x = defaults.bar_x_padding + prompt_width +
+            rp_text_width(s, line->buffer, start, NULL);
+    }
+
+    /* Redraw from the damage to the right edge in the back buffer. */
+    XSetForeground(dpy, b->gc, rp_glob_screen.bgcolor);
+    XFillRectangle(dpy, b->pixmap, b->gc, x, 0, total_width - x, height);
 
-    gcv.function = GXxor;
-    gcv.foreground = rp_glob_screen.fgcolor ^ rp_glob_screen.bgcolor;
-    lgc = XCreateGC(dpy, s->input_window, GCFunction | GCForeground, &gcv);
+    if (full)
+        rp_draw_string(s, b->pixmap, STYLE_NORMAL,
+                       defaults.bar_x_padding,
+                       defaults.bar_y_padding + FONT_ASCENT(s),
+                       line->prompt, -1, NULL, NULL);
+
+    rp_draw_string(s, b->pixmap, STYLE_NORMAL,
+                   defaults.bar_x_padding + prompt_width +
+                   rp_text_width(s, line->buffer, start, NULL),
+                   defaults.bar_y_padding + FONT_ASCENT(s),
+                   line->buffer + start, line->length - start, NULL, NULL);
 
     /* Draw a cheap-o cursor - MkIII */
-    XFillRectangle(dpy, s->input_window, lgc,
+    XSetFunction(dpy, b->gc, GXxor);
+    XSetForeground(dpy, b->gc,
+                   rp_glob_screen.fgcolor ^ rp_glob_screen.bgcolor);
+    XFillRectangle(dpy, b->pixmap, b->gc,
                    defaults.bar_x_padding + prompt_width +
                    rp_text_width(s, line->buffer, line->position, NULL),
                    defaults.bar_y_padding,
                    rp_text_width(s, &line->buffer[line->position],
                                  char_len, NULL), FONT_HEIGHT(s));
+    XSetFunction(dpy, b->gc, GXcopy);
+
+    /* Install the new contents, the old background may be a copy. */
+    XSetWindowBackgroundPixmap(dpy, s->input_window, b->pixmap);
+    XCopyArea(dpy, b->pixmap, s->input_window, b->gc, x, 0,
+              total_width - x, height, x, 0);
+
+    line->drawn = xrealloc(line->drawn, line->length + 1);
+    memcpy(line->drawn, line->buffer, line->length + 1);
+    line->drawn_length = line->length;
+    line->drawn_position = line->position;
+    line->drawn_width = total_width;
 
     XFlush(dpy);
-    XFreeGC(dpy, lgc);
 }
 
 char *get_input(char *prompt, completion_fn fn)
@@ -468,21 +556,24 @@ char *get_more_input(char *prompt, char *preinput,
         XUninstallColormap(dpy, current_window()->colormap);
     XInstallColormap(dpy, s->def_cmap);
 
+    /*
+     * Draw before mapping, so the window comes up showing the prompt
+     * rather than the last one.
+     */
+    update_input_window(s, line);
+
     XMapWindow(dpy, s->input_window);
     XRaiseWindow(dpy, s->input_window);
 
     hide_bar(s, 1);
 
-    XClearWindow(dpy, s->input_window);
     /* Switch focus to our input window to read the next key events. */
     XGetInputFocus(dpy, &focus, &revert);
     set_window_focus(s->input_window);
     XSync(dpy, False);
 
-    update_input_window(s, line);
-
     while (!done) {
-        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf));
+        read_key(&ch, &modifier, keysym_buf, sizeof(keysym_buf), 0);
         modifier = x11_mask_to_rp_mask(modifier);
         PRINT_INPUT_DEBUG(("ch = %ld, modifier = %d, keysym_buf = %s\n",
                            ch, modifier, keysym_buf));
@@ -0,0 +1,281 @@
+/*
+ * Event latency tracing.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+/*
+ * When tracing is on, every event taken off the queue gets a sample in a
+ * fixed ring. The event loop and the key handling code mark the stages they
+ * reach, in microseconds since the event was dequeued. Everything runs on the
+ * one thread, so the ring needs no locking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "poison.h"
+
+#define LATENCY_SAMPLES 1024
+
+struct latency_sample {
+    /* The X event type. */
+    int type;
+
+    /* The server timestamp, for events that carry one. */
+    Time time;
+
+    /* When the event was dequeued, in microseconds. */
+    long long dequeued;
+
+    /* Microseconds after dequeueing each stage was reached, or -1. */
+    long stamp[LAT_NSTAGES];
+};
+
+static const char *stage_names[LAT_NSTAGES] = {
+    "dequeue", "cooked", "lookup", "dispatch", "request", "handled",
+    "flushed"
+};
+
+static struct latency_sample samples[LATENCY_SAMPLES];
+static unsigned long nsamples;
+static struct latency_sample *current;
+static int tracing;
+
+/* The after function that was installed before ours. */
+static int (*old_after_fn)(Display *);
+
+static long long now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Xlib calls this after every request it queues. */
+static int latency_after_fn(Display *d)
+{
+    latency_mark(LAT_REQUEST);
+    if (old_after_fn)
+        return old_after_fn(d);
+    return 0;
+}
+
+static Time event_time(XEvent *ev)
+{
+    switch (ev->type) {
+    case KeyPress:
+    case KeyRelease:
+        return ev->xkey.time;
+    case ButtonPress:
+    case ButtonRelease:
+        return ev->xbutton.time;
+    case PropertyNotify:
+        return ev->xproperty.time;
+    default:
+        return CurrentTime;
+    }
+}
+
+static const char *event_name(int type)
+{
+    static char buf[16];
+
+    switch (type) {
+    case KeyPress:
+        return "KeyPress";
+    case ButtonPress:
+        return "ButtonPress";
+    case MapRequest:
+        return "MapRequest";
+    case ConfigureRequest:
+        return "ConfigureRequest";
+    case ConfigureNotify:
+        return "ConfigureNotify";
+    case PropertyNotify:
+        return "PropertyNotify";
+    case ClientMessage:
+        return "ClientMessage";
+    case CreateNotify:
+        return "CreateNotify";
+    case DestroyNotify:
+        return "DestroyNotify";
+    case UnmapNotify:
+        return "UnmapNotify";
+    case FocusOut:
+        return "FocusOut";
+    default:
+        snprintf(buf, sizeof(buf), "Event%d", type);
+        return buf;
+    }
+}
+
+void latency_enable(int on)
+{
+    if (on == tracing)
+        return;
+
+    tracing = on;
+    current = NULL;
+    if (on)
+        old_after_fn = XSetAfterFunction(dpy, latency_after_fn);
+    else
+        XSetAfterFunction(dpy, old_after_fn);
+}
+
+int latency_enabled(void)
+{
+    return tracing;
+}
+
+void latency_reset(void)
+{
+    nsamples = 0;
+    current = NULL;
+}
+
+void latency_begin(XEvent *ev)
+{
+    int i;
+
+    if (!tracing)
+        return;
+
+    current = &samples[nsamples++ % LATENCY_SAMPLES];
+    current->type = ev->type;
+    current->time = event_time(ev);
+    current->dequeued = now_usec();
+    current->stamp[LAT_DEQUEUE] = 0;
+    for (i = LAT_DEQUEUE + 1; i < LAT_NSTAGES; i++)
+        current->stamp[i] = -1;
+}
+
+/* Drop the sample just begun, for an event that turned out not to count. */
+void latency_cancel(void)
+{
+    if (current == NULL)
+        return;
+
+    nsamples--;
+    current = NULL;
+}
+
+/* Record the first time the current event reaches stage. */
+void latency_mark(int stage)
+{
+    if (current == NULL || current->stamp[stage] >= 0)
+        return;
+
+    current->stamp[stage] = now_usec() - current->dequeued;
+}
+
+void latency_end(void)
+{
+    current = NULL;
+}
+
+static int long_cmp(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Append the p50/p90/p99/max of each stage for events of this type. */
+static void
+summarize_type(int type, long *vals, int count, struct sbuf *buf)
+{
+    int stage, i, n, events = 0;
+
+    for (i = 0; i < count; i++)
+        if (samples[i].type == type)
+            events++;
+
+    sbuf_printf_concat(buf, "%s: %d events, usec p50/p90/p99/max\n",
+                       event_name(type), events);
+
+    for (stage = LAT_DEQUEUE + 1; stage < LAT_NSTAGES; stage++) {
+        n = 0;
+        for (i = 0; i < count; i++) {
+            if (samples[i].type == type && samples[i].stamp[stage] >= 0)
+                vals[n++] = samples[i].stamp[stage];
+        }
+        if (n == 0)
+            continue;
+
+        qsort(vals, n, sizeof(long), long_cmp);
+        sbuf_printf_concat(buf, "  %-8s %ld/%ld/%ld/%ld\n",
+                           stage_names[stage], vals[(n - 1) * 50 / 100],
+                           vals[(n - 1) * 90 / 100],
+                           vals[(n - 1) * 99 / 100], vals[n - 1]);
+    }
+}
+
+void latency_summary(struct sbuf *buf)
+{
+    int count, i, j;
+    long *vals;
+
+    count = nsamples < LATENCY_SAMPLES ? nsamples : LATENCY_SAMPLES;
+    if (count == 0) {
+        sbuf_concat(buf, tracing ? "latency: no samples yet" :
+                    "latency: tracing is off");
+        return;
+    }
+
+    vals = xmalloc(sizeof(long) * count);
+
+    /* Summarize each event type once, in the order first seen. */
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < i; j++)
+            if (samples[j].type == samples[i].type)
+                break;
+        if (j == i)
+            summarize_type(samples[i].type, vals, count, buf);
+    }
+
+    free(vals);
+    sbuf_chop(buf);
+}
+
+/* One line per sample, oldest first. Unreached stages are left empty. */
+void latency_csv(struct sbuf *buf)
+{
+    struct latency_sample *s;
+    unsigned long i, first;
+    int stage;
+
+    sbuf_concat(buf, "event,server_time,dequeued");
+    for (stage = LAT_DEQUEUE + 1; stage < LAT_NSTAGES; stage++)
+        sbuf_printf_concat(buf, ",%s", stage_names[stage]);
+    sbuf_concat(buf, "\n");
+
+    first = nsamples > LATENCY_SAMPLES ? nsamples - LATENCY_SAMPLES : 0;
+    for (i = first; i < nsamples; i++) {
+        s = &samples[i % LATENCY_SAMPLES];
+        sbuf_printf_concat(buf, "%s,%lu,%lld", event_name(s->type),
+                           (unsigned long) s->time, s->dequeued);
+        for (stage = LAT_DEQUEUE + 1; stage < LAT_NSTAGES; stage++) {
+            if (s->stamp[stage] >= 0)
+                sbuf_printf_concat(buf, ",%ld", s->stamp[stage]);
+            else
+                sbuf_concat(buf, ",");
+        }
+        sbuf_concat(buf, "\n");
+    }
+}
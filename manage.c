@@ -23,13 +23,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <err.h>
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/keysymdef.h>
+#include <xcb/res.h>
 
 #include "poison.h"
 
@@ -39,7 +42,281 @@ static int num_unmanaged_windows = 0;
 static char **floated_window_list = NULL;
 static int num_floated_windows = 0;
 
-static char *get_wmname(Window w);
+/*
+ * The _NET_WM_WINDOW_TYPE and name of top level windows we don't manage, such
+ * as docks and override redirect windows, so raising or mapping them doesn't
+ * query each one every time. We add PropertyChangeMask to whatever is
+ * selected on them to hear about changes, and drop the entry when the window
+ * changes type or name or goes away. The entries live in an open addressed hash table keyed by the
+ * window, with None marking a free slot.
+ */
+struct unmanaged_type {
+    Window w;
+    Atom window_type;
+    char *wm_name;
+};
+
+static struct unmanaged_type *unmanaged_types = NULL;
+static int unmanaged_types_size = 0;
+static int unmanaged_types_count = 0;
+
+static unsigned int unmanaged_type_hash(Window w, int size)
+{
+    unsigned long h;
+
+    h = (unsigned long) w * 2654435761UL;
+    return (h ^ (h >> 16)) & (size - 1);
+}
+
+/* Return w's entry, or the free slot it would go in. */
+static struct unmanaged_type *unmanaged_type_slot(Window w)
+{
+    unsigned int h;
+
+    h = unmanaged_type_hash(w, unmanaged_types_size);
+    while (unmanaged_types[h].w != None && unmanaged_types[h].w != w)
+        h = (h + 1) & (unmanaged_types_size - 1);
+
+    return &unmanaged_types[h];
+}
+
+static struct unmanaged_type *unmanaged_type_add(Window w, Atom window_type,
+                                                 char *wm_name)
+{
+    struct unmanaged_type *old, *slot;
+    int i, old_size;
+
+    /* Keep the table at most half full so the probe runs stay short. */
+    if ((unmanaged_types_count + 1) * 2 > unmanaged_types_size) {
+        old = unmanaged_types;
+        old_size = unmanaged_types_size;
+        unmanaged_types_size = old_size ? old_size * 2 : 32;
+        unmanaged_types = xmalloc(unmanaged_types_size *
+                                  sizeof(struct unmanaged_type));
+        for (i = 0; i < unmanaged_types_size; i++)
+            unmanaged_types[i].w = None;
+        for (i = 0; i < old_size; i++) {
+            if (old[i].w != None)
+                *unmanaged_type_slot(old[i].w) = old[i];
+        }
+        free(old);
+    }
+
+    slot = unmanaged_type_slot(w);
+    if (slot->w == None)
+        unmanaged_types_count++;
+    else
+        free(slot->wm_name);
+    slot->w = w;
+    slot->window_type = window_type;
+    slot->wm_name = wm_name;
+
+    return slot;
+}
+
+/*
+ * The children of the root window, bottom to top, as XQueryTree would return
+ * them. scanwins seeds it and stacking_notify keeps it current from the
+ * SubstructureNotify events on the root.
+ */
+static Window *stack_wins = NULL;
+static int stack_len = 0;
+static int stack_size = 0;
+
+/*
+ * The properties of a window we read. window_props_fetch() sends the
+ * requests for all of those it is asked for through xcb before waiting for
+ * any reply, so reading any number of them takes one round trip.
+ */
+enum {
+    PROP_NET_WM_NAME,
+    PROP_WM_NAME,
+    PROP_WM_CLASS,
+    PROP_WM_NORMAL_HINTS,
+    PROP_WM_HINTS,
+    PROP_WM_PROTOCOLS,
+    PROP_WM_TRANSIENT_FOR,
+    PROP_NET_WM_WINDOW_TYPE,
+    PROP_NET_WM_PID,
+    PROP_WM_CLIENT_MACHINE,
+    PROPS
+};
+
+/*
+ * What to fetch: properties by their bit, the window's attributes, the
+ * pointer position, the client's pid from the X-Resource extension and the
+ * window's geometry.
+ */
+#define WANT(prop)		(1U << (prop))
+#define WANT_NAME		(WANT(PROP_NET_WM_NAME) | WANT(PROP_WM_NAME))
+#define WANT_ATTRIBUTES		(1U << PROPS)
+#define WANT_POINTER		(1U << (PROPS + 1))
+#define WANT_CLIENT_PID		(1U << (PROPS + 2))
+#define WANT_GEOMETRY		(1U << (PROPS + 3))
+#define WANT_ALL		(WANT_GEOMETRY | (WANT_GEOMETRY - 1))
+#define WANT_PID		(WANT(PROP_NET_WM_PID) | \
+				 WANT(PROP_WM_CLIENT_MACHINE) | WANT_CLIENT_PID)
+
+/* The most of a property we read, in 32 bit units. */
+#define PROP_LENGTH		1024
+
+struct window_props {
+    xcb_get_property_reply_t *prop[PROPS];
+    xcb_get_window_attributes_reply_t *attr;
+    xcb_query_pointer_reply_t *pointer;
+    xcb_res_query_client_ids_reply_t *client_ids;
+    xcb_get_geometry_reply_t *geom;
+};
+
+static Atom prop_atom(int prop)
+{
+    switch (prop) {
+    case PROP_NET_WM_NAME:
+        return _net_wm_name;
+    case PROP_WM_NAME:
+        return XA_WM_NAME;
+    case PROP_WM_CLASS:
+        return XA_WM_CLASS;
+    case PROP_WM_NORMAL_HINTS:
+        return XA_WM_NORMAL_HINTS;
+    case PROP_WM_HINTS:
+        return XA_WM_HINTS;
+    case PROP_WM_PROTOCOLS:
+        return wm_protocols;
+    case PROP_WM_TRANSIENT_FOR:
+        return XA_WM_TRANSIENT_FOR;
+    case PROP_NET_WM_PID:
+        return _net_wm_pid;
+    case PROP_WM_CLIENT_MACHINE:
+        return XA_WM_CLIENT_MACHINE;
+    default:
+        return _net_wm_window_type;
+    }
+}
+
+/* Querying an extension the server lacks would close the connection. */
+static int have_xres(xcb_connection_t *c)
+{
+    const xcb_query_extension_reply_t *ext;
+
+    ext = xcb_get_extension_data(c, &xcb_res_id);
+    return ext && ext->present;
+}
+
+static void window_props_fetch(Window w, unsigned int want,
+                               struct window_props *p)
+{
+    xcb_connection_t *c = XGetXCBConnection(dpy);
+    xcb_get_property_cookie_t cookie[PROPS];
+    xcb_get_window_attributes_cookie_t attr_cookie;
+    xcb_query_pointer_cookie_t pointer_cookie;
+    xcb_res_query_client_ids_cookie_t ids_cookie;
+    xcb_res_client_id_spec_t spec;
+    xcb_get_geometry_cookie_t geom_cookie;
+    xcb_generic_error_t *err;
+    int i;
+
+    memset(p, 0, sizeof(*p));
+
+    if ((want & WANT_CLIENT_PID) && !have_xres(c))
+        want &= ~WANT_CLIENT_PID;
+
+    for (i = 0; i < PROPS; i++) {
+        if (want & WANT(i))
+            cookie[i] = xcb_get_property(c, 0, w, prop_atom(i),
+                                         XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                         PROP_LENGTH);
+    }
+    if (want & WANT_ATTRIBUTES)
+        attr_cookie = xcb_get_window_attributes(c, w);
+    if (want & WANT_POINTER)
+        pointer_cookie = xcb_query_pointer(c, w);
+    if (want & WANT_CLIENT_PID) {
+        spec.client = w;
+        spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
+        ids_cookie = xcb_res_query_client_ids(c, 1, &spec);
+    }
+    if (want & WANT_GEOMETRY)
+        geom_cookie = xcb_get_geometry(c, w);
+
+    /*
+     * Errors, from a window that went away say, come back here instead of
+     * going to the error handler.
+     */
+    for (i = 0; i < PROPS; i++) {
+        if (!(want & WANT(i)))
+            continue;
+        err = NULL;
+        p->prop[i] = xcb_get_property_reply(c, cookie[i], &err);
+        free(err);
+
+        /* A property the window doesn't have comes back with no type. */
+        if (p->prop[i] && p->prop[i]->type == XCB_NONE) {
+            free(p->prop[i]);
+            p->prop[i] = NULL;
+        }
+    }
+    if (want & WANT_ATTRIBUTES) {
+        err = NULL;
+        p->attr = xcb_get_window_attributes_reply(c, attr_cookie, &err);
+        free(err);
+    }
+    if (want & WANT_POINTER) {
+        err = NULL;
+        p->pointer = xcb_query_pointer_reply(c, pointer_cookie, &err);
+        free(err);
+    }
+    if (want & WANT_CLIENT_PID) {
+        err = NULL;
+        p->client_ids = xcb_res_query_client_ids_reply(c, ids_cookie, &err);
+        free(err);
+    }
+    if (want & WANT_GEOMETRY) {
+        err = NULL;
+        p->geom = xcb_get_geometry_reply(c, geom_cookie, &err);
+        free(err);
+    }
+}
+
+static void window_props_free(struct window_props *p)
+{
+    int i;
+
+    for (i = 0; i < PROPS; i++)
+        free(p->prop[i]);
+    free(p->attr);
+    free(p->pointer);
+    free(p->client_ids);
+    free(p->geom);
+}
+
+/*
+ * Return the value of the property if it has that type (or any, for
+ * AnyPropertyType) and format, with the number of items in n.
+ */
+static void *window_prop_value(struct window_props *p, int prop, Atom type,
+                               int format, int *n)
+{
+    xcb_get_property_reply_t *r = p->prop[prop];
+
+    if (r == NULL || r->format != format
+        || (type != AnyPropertyType && r->type != type))
+        return NULL;
+
+    *n = xcb_get_property_value_length(r) / (format / 8);
+    return xcb_get_property_value(r);
+}
+
+/* A copy of the first string in a property value, which needn't end in NUL. */
+static char *window_prop_string(const char *val, int len)
+{
+    char *str;
+
+    str = xmalloc(len + 1);
+    memcpy(str, val, len);
+    str[len] = '\0';
+    return str;
+}
 
 void clear_unmanaged_list(void)
 {
@@ -151,26 +428,19 @@ void add_floated_window(char *name)
     floated_window_list = tmp;
 }
 
-int floated_window(Window w)
+/* win's name must be up to date, as update_window_information leaves it. */
+int floated_window(rp_window *win)
 {
-    char *wname;
     int i;
 
-    if (!floated_window_list)
-        return 0;
-
-    wname = get_wmname(w);
-    if (!wname)
+    if (!floated_window_list || !win->wm_name)
         return 0;
 
     for (i = 0; i < num_floated_windows; i++) {
-        if (!strcmp(floated_window_list[i], wname)) {
-            free(wname);
+        if (!strcmp(floated_window_list[i], win->wm_name))
             return 1;
-        }
     }
 
-    free(wname);
     return 0;
 }
 
@@ -195,9 +465,36 @@ void ungrab_top_level_keys(Window w)
     XUngrabKey(dpy, AnyKey, AnyModifier, w);
 }
 
+/*
+ * Return 1 if s is the first screen in rp_screens using its root window. With
+ * xrandr every screen shares the same root, so it only needs grabbing once.
+ */
+static int first_screen_on_root(rp_screen *s)
+{
+    rp_screen *cur;
+
+    list_for_each_entry(cur, &rp_screens, node) {
+        if (cur == s)
+            return 1;
+        if (cur->root == s->root)
+            return 0;
+    }
+
+    return 1;
+}
+
 void ungrab_keys_all_wins(void)
 {
     rp_window *cur;
+    rp_screen *s;
+
+    if (defaults.root_key_grab) {
+        list_for_each_entry(s, &rp_screens, node) {
+            if (first_screen_on_root(s))
+                ungrab_top_level_keys(s->root);
+        }
+        return;
+    }
 
     /* Remove the grab on the current prefix key */
     list_for_each_entry(cur, &rp_mapped_window, node) {
@@ -208,18 +505,64 @@ void ungrab_keys_all_wins(void)
 void grab_keys_all_wins(void)
 {
     rp_window *cur;
+    rp_screen *s;
+
+    /*
+     * In root mode the passive grabs on the root window cover every client,
+     * so the cost no longer depends on the number of mapped windows.
+     */
+    if (defaults.root_key_grab) {
+        list_for_each_entry(s, &rp_screens, node) {
+            if (first_screen_on_root(s))
+                grab_top_level_keys(s->root);
+        }
+        return;
+    }
 
-    /* Remove the grab on the current prefix key */
     list_for_each_entry(cur, &rp_mapped_window, node) {
         grab_top_level_keys(cur->w);
     }
 }
 
-void update_normal_hints(rp_window *win)
+/*
+ * Read WM_NORMAL_HINTS the way XGetWMNormalHints does. The hints are left
+ * alone when the property is missing or malformed.
+ */
+static void normal_hints_from(rp_window *win, struct window_props *p)
 {
-    long supplied;
+    XSizeHints *h = win->hints;
+    uint32_t *v;
+    int n;
 
-    XGetWMNormalHints(dpy, win->w, win->hints, &supplied);
+    format_invalidate(win);
+
+    v = window_prop_value(p, PROP_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 32, &n);
+    if (v == NULL || n < 15)
+        return;
+
+    h->flags = v[0] & (USPosition | USSize | PAllHints);
+    h->x = (int32_t) v[1];
+    h->y = (int32_t) v[2];
+    h->width = (int32_t) v[3];
+    h->height = (int32_t) v[4];
+    h->min_width = (int32_t) v[5];
+    h->min_height = (int32_t) v[6];
+    h->max_width = (int32_t) v[7];
+    h->max_height = (int32_t) v[8];
+    h->width_inc = (int32_t) v[9];
+    h->height_inc = (int32_t) v[10];
+    h->min_aspect.x = (int32_t) v[11];
+    h->min_aspect.y = (int32_t) v[12];
+    h->max_aspect.x = (int32_t) v[13];
+    h->max_aspect.y = (int32_t) v[14];
+
+    /* Older clients set the 15 element version without these. */
+    if (n >= 18) {
+        h->flags |= v[0] & (PBaseSize | PWinGravity);
+        h->base_width = (int32_t) v[15];
+        h->base_height = (int32_t) v[16];
+        h->win_gravity = (int32_t) v[17];
+    }
 
     /* Discard bogus hints */
     if ((win->hints->flags & PAspect) && (win->hints->min_aspect.x < 1 ||
@@ -251,42 +594,46 @@ void update_normal_hints(rp_window *win)
 #endif
 }
 
-static char *get_wmname(Window w)
+void update_normal_hints(rp_window *win)
 {
-    char *name = NULL;
+    struct window_props p;
+
+    window_props_fetch(win->w, WANT(PROP_WM_NORMAL_HINTS), &p);
+    normal_hints_from(win, &p);
+    window_props_free(&p);
+}
+
+static char *get_wmname(struct window_props *p)
+{
+    char *name = NULL, *val;
     XTextProperty text_prop;
-    Atom type = None;
-    int ret = None, n;
-    unsigned long nitems, bytes_after;
-    int format;
+    int ret, n, len;
     char **cl;
-    unsigned char *val = NULL;
 
     /*
      * Try to use the window's _NET_WM_NAME ewmh property
      */
-    ret = XGetWindowProperty(dpy, w, _net_wm_name, 0, 40, False,
-                             xa_utf8_string, &type, &format, &nitems,
-                             &bytes_after, &val);
+    val = window_prop_value(p, PROP_NET_WM_NAME, xa_utf8_string, 8, &len);
     /* We have a valid UTF-8 string */
-    if (ret == Success && type == xa_utf8_string && format == 8 &&
-        nitems > 0) {
-        name = xstrdup((char *) val);
-        XFree(val);
+    if (val && len > 0) {
+        name = window_prop_string(val, len);
         PRINT_DEBUG(("Fetching window name using "
                      "_NET_WM_NAME succeeded\n"));
         PRINT_DEBUG(("WM_NAME: %s\n", name));
         return name;
     }
-    /* Something went wrong for whatever reason */
-    if (ret == Success && val)
-        XFree(val);
     PRINT_DEBUG(("Could not fetch window name using _NET_WM_NAME\n"));
 
-    if (XGetWMName(dpy, w, &text_prop) == 0) {
-        PRINT_DEBUG(("XGetWMName failed\n"));
+    val = window_prop_value(p, PROP_WM_NAME, AnyPropertyType, 8, &len);
+    if (val == NULL) {
+        PRINT_DEBUG(("No WM_NAME\n"));
         return NULL;
     }
+    text_prop.value = (unsigned char *) window_prop_string(val, len);
+    text_prop.encoding = p->prop[PROP_WM_NAME]->type;
+    text_prop.format = 8;
+    text_prop.nitems = len;
+
     PRINT_DEBUG(("WM_NAME encoding: "));
     if (text_prop.encoding == xa_string)
         PRINT_DEBUG(("STRING\n"));
@@ -320,10 +667,10 @@ static char *get_wmname(Window w)
     if (ret == Success && cl && n > 0) {
         name = xstrdup(cl[0]);
         XFreeStringList(cl);
-    } else if (text_prop.value) {
+        free(text_prop.value);
+    } else {
         /* Convertion failed, try to get the raw string */
-        name = xstrdup((char *) text_prop.value);
-        XFree(text_prop.value);
+        name = (char *) text_prop.value;
     }
     if (name == NULL) {
         PRINT_DEBUG(("I can't get the WMName.\n"));
@@ -334,18 +681,51 @@ static char *get_wmname(Window w)
     return name;
 }
 
-static XClassHint *get_class_hints(Window w)
+/* Update *field to str if it changed. Return 1 if it did. */
+static int update_class_field(char **field, char *str)
 {
-    XClassHint *class;
+    if (*field != NULL && !strcmp(*field, str))
+        return 0;
+
+    free(*field);
+    *field = xstrdup(str);
+    return 1;
+}
 
-    class = XAllocClassHint();
+static int update_window_name_from(rp_window *win, struct window_props *p)
+{
+    char *newstr, *val, *res_name;
+    int changed = 0, len, name_len;
 
-    if (class == NULL)
-        errx(1, "not enough memory for WM_CLASS structure");
+    newstr = get_wmname(p);
+    if (newstr != NULL) {
+        changed = changed || win->wm_name == NULL ||
+            strcmp(newstr, win->wm_name);
+        free(win->wm_name);
+        win->wm_name = newstr;
+    }
 
-    XGetClassHint(dpy, w, class);
+    /* WM_CLASS is the instance name and the class name, each ending in NUL. */
+    val = window_prop_value(p, PROP_WM_CLASS, XA_STRING, 8, &len);
+    if (val != NULL) {
+        res_name = window_prop_string(val, len);
+        name_len = strlen(res_name);
+        changed |= update_class_field(&win->res_name, res_name);
+        free(res_name);
+
+        /* As XGetClassHint, a missing class name is an empty one. */
+        if (name_len < len)
+            res_name = window_prop_string(val + name_len + 1,
+                                          len - name_len - 1);
+        else
+            res_name = xstrdup("");
+        changed |= update_class_field(&win->res_class, res_name);
+        free(res_name);
+    }
 
-    return class;
+    if (changed)
+        format_invalidate(win);
+    return changed;
 }
 
 /*
@@ -354,36 +734,13 @@ static XClassHint *get_class_hints(Window w)
  */
 int update_window_name(rp_window *win)
 {
-    char *newstr;
-    int changed = 0;
-    XClassHint *class;
+    struct window_props p;
+    int changed;
+
+    window_props_fetch(win->w, WANT_NAME | WANT(PROP_WM_CLASS), &p);
+    changed = update_window_name_from(win, &p);
+    window_props_free(&p);
 
-    newstr = get_wmname(win->w);
-    if (newstr != NULL) {
-        changed = changed || win->wm_name == NULL ||
-            strcmp(newstr, win->wm_name);
-        free(win->wm_name);
-        win->wm_name = newstr;
-    }
-    class = get_class_hints(win->w);
-
-    if (class->res_class != NULL
-        && (win->res_class == NULL
-            || strcmp(class->res_class, win->res_class))) {
-        changed = 1;
-        free(win->res_class);
-        win->res_class = xstrdup(class->res_class);
-    }
-    if (class->res_name != NULL
-        && (win->res_name == NULL
-            || strcmp(class->res_name, win->res_name))) {
-        changed = 1;
-        free(win->res_name);
-        win->res_name = xstrdup(class->res_name);
-    }
-    XFree(class->res_name);
-    XFree(class->res_class);
-    XFree(class);
     return changed;
 }
 
@@ -405,81 +762,296 @@ int window_is_transient(rp_window *win)
         ;
 }
 
-Atom get_net_wm_window_type(rp_window *win)
+static Atom window_type_from(struct window_props *p)
 {
-    Atom type, window_type = None;
-    int format;
-    unsigned long nitems;
-    unsigned long bytes_left;
-    unsigned char *data;
+    uint32_t *types;
+    int n;
+
+    types = window_prop_value(p, PROP_NET_WM_WINDOW_TYPE, XA_ATOM, 32, &n);
+    if (types == NULL || n == 0)
+        return None;
+
+    return types[0];
+}
+
+static Atom window_type(Window w)
+{
+    struct window_props p;
+    Atom type;
+
+    window_props_fetch(w, WANT(PROP_NET_WM_WINDOW_TYPE), &p);
+    type = window_type_from(&p);
+    window_props_free(&p);
 
+    return type;
+}
+
+Atom get_net_wm_window_type(rp_window *win)
+{
     if (win == NULL)
         return None;
 
-    if (XGetWindowProperty(dpy, win->w, _net_wm_window_type, 0, 1L,
-                           False, XA_ATOM, &type, &format, &nitems,
-                           &bytes_left, &data) == Success && nitems > 0) {
-        window_type = *(Atom *) data;
-        XFree(data);
+    return win->window_type;
+}
+
+/* Reread _NET_WM_WINDOW_TYPE after it changed. */
+void update_window_type(rp_window *win)
+{
+    win->window_type = window_type(win->w);
+}
+
+/* Drop what we know about an unmanaged window's type. */
+void forget_window_type(Window w)
+{
+    struct unmanaged_type *slot, moved;
+    unsigned int h;
+
+    if (unmanaged_types_count == 0)
+        return;
+
+    slot = unmanaged_type_slot(w);
+    if (slot->w == None)
+        return;
+    slot->w = None;
+    free(slot->wm_name);
+    unmanaged_types_count--;
+
+    /*
+     * Entries further along the run may have probed past this slot, so put
+     * each of them back where a lookup will find it.
+     */
+    h = slot - unmanaged_types;
+    for (;;) {
+        h = (h + 1) & (unmanaged_types_size - 1);
+        if (unmanaged_types[h].w == None)
+            break;
+        moved = unmanaged_types[h];
+        unmanaged_types[h].w = None;
+        *unmanaged_type_slot(moved.w) = moved;
     }
-    return window_type;
 }
 
-int is_unmanaged_window_type(Window win)
+/*
+ * The side table entry for w, a window we don't manage, fetching it the first
+ * time. Return NULL if the window is gone.
+ */
+static struct unmanaged_type *unmanaged_info(Window w)
 {
-    Atom win_type;
-    rp_window tmp;
+    struct unmanaged_type *slot;
+    struct window_props p;
+
+    if (unmanaged_types_count) {
+        slot = unmanaged_type_slot(w);
+        if (slot->w == w)
+            return slot;
+    }
+
+    /*
+     * Fetch the type and name along with the event mask we already
+     * selected, so adding PropertyChangeMask keeps the rest of it.
+     */
+    window_props_fetch(w, WANT_NAME | WANT(PROP_NET_WM_WINDOW_TYPE)
+                       | WANT_ATTRIBUTES, &p);
+
+    /* The window is gone already, so there is nothing to listen to. */
+    if (p.attr == NULL) {
+        window_props_free(&p);
+        return NULL;
+    }
 
-    tmp.w = win;
-    win_type = get_net_wm_window_type(&tmp);
-    if (win_type == _net_wm_window_type_dock ||
+    ignore_badwindow++;
+    XSelectInput(dpy, w, p.attr->your_event_mask | PropertyChangeMask);
+    ignore_badwindow--;
+
+    slot = unmanaged_type_add(w, window_type_from(&p), get_wmname(&p));
+    window_props_free(&p);
+
+    return slot;
+}
+
+static Atom cached_window_type(Window w)
+{
+    struct unmanaged_type *info;
+    rp_window *win;
+
+    if ((win = find_window(w)))
+        return win->window_type;
+
+    if ((info = unmanaged_info(w)) == NULL)
+        return None;
+
+    return info->window_type;
+}
+
+static int unmanaged_window_type(Atom win_type)
+{
+    return win_type == _net_wm_window_type_dock ||
         win_type == _net_wm_window_type_splash ||
         win_type == _net_wm_window_type_tooltip ||
-        win_type == _net_wm_window_type_utility)
-        return 1;
+        win_type == _net_wm_window_type_utility;
+}
 
-    return 0;
+int is_unmanaged_window_type(Window win)
+{
+    return unmanaged_window_type(cached_window_type(win));
 }
 
-void update_window_information(rp_window *win)
+/* Take the InputHint from WM_HINTS, if it has one. */
+static void input_hint_from(rp_window *win, struct window_props *p)
 {
-    XWindowAttributes attr;
-    XWMHints *wm_hints;
+    uint32_t *v;
+    int n;
 
-    update_window_name(win);
+    /* Clients from before ICCCM 1.0 leave out the window group. */
+    v = window_prop_value(p, PROP_WM_HINTS, XA_WM_HINTS, 32, &n);
+    if (v == NULL || n < 8 || !(v[0] & InputHint))
+        return;
+
+    win->accepts_input = v[1] ? True : False;
+    PRINT_DEBUG(("Window '%s' accepts_input: %d\n",
+                 window_name(win), win->accepts_input));
+}
+
+/* Check if window supports WM_TAKE_FOCUS protocol */
+static void protocols_from(rp_window *win, struct window_props *p)
+{
+    uint32_t *protocols;
+    int i, n;
+
+    win->supports_wm_take_focus = 0;
+
+    protocols = window_prop_value(p, PROP_WM_PROTOCOLS, XA_ATOM, 32, &n);
+    for (i = 0; protocols && i < n; i++) {
+        if (protocols[i] == wm_take_focus) {
+            win->supports_wm_take_focus = 1;
+            PRINT_DEBUG(("Window '%s' supports WM_TAKE_FOCUS\n",
+                         window_name(win)));
+            break;
+        }
+    }
+}
 
-    /* Get the WM Hints */
-    update_normal_hints(win);
+/*
+ * The pid of the client behind the window: _NET_WM_PID, or else what the
+ * X-Resource extension knows. It's only of use when the client runs on this
+ * host, going by WM_CLIENT_MACHINE when it is set.
+ */
+static void pid_from(rp_window *win, struct window_props *p)
+{
+    xcb_res_client_id_value_iterator_t it;
+    char localhost[256], *machine, *val;
+    uint32_t *pid;
+    int n;
 
-    /* Check if window accepts input focus */
-    wm_hints = XGetWMHints(dpy, win->w);
-    if (wm_hints) {
-        if (wm_hints->flags & InputHint) {
-            win->accepts_input = wm_hints->input;
-            PRINT_DEBUG(("Window '%s' accepts_input: %d\n",
-                         window_name(win), win->accepts_input));
+    win->pid = 0;
+    pid = window_prop_value(p, PROP_NET_WM_PID, XA_CARDINAL, 32, &n);
+    if (pid && n > 0) {
+        win->pid = pid[0];
+    } else if (p->client_ids) {
+        it = xcb_res_query_client_ids_ids_iterator(p->client_ids);
+        for (; it.rem; xcb_res_client_id_value_next(&it)) {
+            if (it.data->spec.mask != XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID
+                || xcb_res_client_id_value_value_length(it.data) < 1)
+                continue;
+            win->pid = *xcb_res_client_id_value_value(it.data);
+            break;
         }
-        XFree(wm_hints);
+    }
+    PRINT_DEBUG(("NET_WM_PID: %ld\n", win->pid));
+
+    /* Without WM_CLIENT_MACHINE, or a name of our own, assume it's local. */
+    win->pid_local = win->pid != 0;
+    val = window_prop_value(p, PROP_WM_CLIENT_MACHINE, XA_STRING, 8, &n);
+    if (win->pid && val && gethostname(localhost, sizeof(localhost)) == 0) {
+        machine = window_prop_string(val, n);
+        win->pid_local = !strcmp(machine, localhost);
+        free(machine);
     }
 
-    /* Check if window supports WM_TAKE_FOCUS protocol */
-    update_window_protocols(win);
+    win->pid_cached = 1;
+}
 
-    /* Get the colormap */
-    XGetWindowAttributes(dpy, win->w, &attr);
-    win->colormap = attr.colormap;
-    win->x = attr.x;
-    win->y = attr.y;
-    win->width = attr.width;
-    win->height = attr.height;
-    win->border = attr.border_width;
-
-    /* Transient status */
-    win->transient =
-        XGetTransientForHint(dpy, win->w, &win->transient_for);
-
-    if (get_net_wm_window_type(win) == _net_wm_window_type_dialog)
+/* Reread the pid after _NET_WM_PID or WM_CLIENT_MACHINE changed. */
+void update_window_pid(rp_window *win)
+{
+    struct window_props p;
+
+    window_props_fetch(win->w, WANT_PID, &p);
+    pid_from(win, &p);
+    window_props_free(&p);
+}
+
+/* Set win's transient status from WM_TRANSIENT_FOR and its window type. */
+static void transient_from(rp_window *win, struct window_props *p)
+{
+    uint32_t *transient_for;
+    int n;
+
+    transient_for = window_prop_value(p, PROP_WM_TRANSIENT_FOR, XA_WINDOW,
+                                      32, &n);
+    if (transient_for && n > 0) {
         win->transient = 1;
+        win->transient_for = transient_for[0];
+    } else {
+        win->transient = 0;
+        win->transient_for = None;
+    }
+
+    if (window_type_from(p) == _net_wm_window_type_dialog)
+        win->transient = 1;
+}
+
+/* Reread the transient status after WM_TRANSIENT_FOR changed. */
+void update_window_transient(rp_window *win)
+{
+    struct window_props p;
+
+    window_props_fetch(win->w, WANT(PROP_WM_TRANSIENT_FOR) |
+                       WANT(PROP_NET_WM_WINDOW_TYPE), &p);
+    transient_from(win, &p);
+    window_props_free(&p);
+    format_invalidate(win);
+}
+
+/*
+ * Fetch everything we need to know about a new window to manage it, all in
+ * one round trip. From then on PropertyNotify, ConfigureRequest and
+ * ColormapNotify keep it up to date.
+ */
+void update_window_information(rp_window *win)
+{
+    struct window_props p;
+
+    window_props_fetch(win->w, WANT_ALL, &p);
+
+    update_window_name_from(win, &p);
+    normal_hints_from(win, &p);
+    input_hint_from(win, &p);
+    protocols_from(win, &p);
+
+    /* Get the colormap */
+    if (p.attr)
+        win->colormap = p.attr->colormap;
+    if (p.geom) {
+        win->x = p.geom->x;
+        win->y = p.geom->y;
+        win->width = p.geom->width;
+        win->height = p.geom->height;
+        win->border = p.geom->border_width;
+    }
+
+    /* Where the pointer was, relative to the root. */
+    if (p.pointer) {
+        win->mouse_x = p.pointer->root_x;
+        win->mouse_y = p.pointer->root_y;
+    }
+
+    transient_from(win, &p);
+    win->window_type = window_type_from(&p);
+    pid_from(win, &p);
+    format_invalidate(win);
+
+    window_props_free(&p);
 
     PRINT_DEBUG(("update_window_information: x:%d y:%d width:%d height:%d "
                  "transient:%d\n", win->x, win->y, win->width, win->height,
@@ -494,17 +1066,11 @@ void update_window_information(rp_window *win)
  */
 void update_window_input_hint(rp_window *win)
 {
-    XWMHints *wm_hints;
+    struct window_props p;
 
-    wm_hints = XGetWMHints(dpy, win->w);
-    if (wm_hints) {
-        if (wm_hints->flags & InputHint) {
-            win->accepts_input = wm_hints->input;
-            PRINT_DEBUG(("Window '%s' accepts_input updated to: %d\n",
-                         window_name(win), win->accepts_input));
-        }
-        XFree(wm_hints);
-    }
+    window_props_fetch(win->w, WANT(PROP_WM_HINTS), &p);
+    input_hint_from(win, &p);
+    window_props_free(&p);
 }
 
 /*
@@ -512,23 +1078,11 @@ void update_window_input_hint(rp_window *win)
  */
 void update_window_protocols(rp_window *win)
 {
-    Atom *protocols;
-    int n;
-    int i;
-
-    win->supports_wm_take_focus = 0;
+    struct window_props p;
 
-    if (XGetWMProtocols(dpy, win->w, &protocols, &n)) {
-        for (i = 0; i < n; i++) {
-            if (protocols[i] == wm_take_focus) {
-                win->supports_wm_take_focus = 1;
-                PRINT_DEBUG(("Window '%s' supports WM_TAKE_FOCUS\n",
-                             window_name(win)));
-                break;
-            }
-        }
-        XFree(protocols);
-    }
+    window_props_fetch(win->w, WANT(PROP_WM_PROTOCOLS), &p);
+    protocols_from(win, &p);
+    window_props_free(&p);
 }
 
 void unmanage(rp_window *w)
@@ -543,6 +1097,99 @@ void unmanage(rp_window *w)
     free_window(w);
 }
 
+static int stack_find(Window w)
+{
+    int i;
+
+    /* Recently created or raised windows sit near the top. */
+    for (i = stack_len - 1; i >= 0; i--)
+        if (stack_wins[i] == w)
+            return i;
+
+    return -1;
+}
+
+static void stack_remove(Window w)
+{
+    int i;
+
+    if ((i = stack_find(w)) < 0)
+        return;
+
+    stack_len--;
+    memmove(&stack_wins[i], &stack_wins[i + 1],
+            sizeof(Window) * (stack_len - i));
+}
+
+/* Put w at position pos, counting from the bottom. */
+static void stack_insert(Window w, int pos)
+{
+    if (stack_len == stack_size) {
+        stack_size = stack_size ? stack_size * 2 : 64;
+        stack_wins = xrealloc(stack_wins, sizeof(Window) * stack_size);
+    }
+
+    memmove(&stack_wins[pos + 1], &stack_wins[pos],
+            sizeof(Window) * (stack_len - pos));
+    stack_wins[pos] = w;
+    stack_len++;
+}
+
+/* Move w just above sibling, or to the bottom if sibling is None. */
+static void stack_place_above(Window w, Window sibling)
+{
+    int pos = 0;
+
+    stack_remove(w);
+    if (sibling != None) {
+        pos = stack_find(sibling) + 1;
+        /* An unknown sibling; the top is the best guess. */
+        if (pos == 0)
+            pos = stack_len;
+    }
+    stack_insert(w, pos);
+}
+
+/* Follow changes to the stacking order of the root's children. */
+void stacking_notify(XEvent *ev)
+{
+    Window root = rp_glob_screen.root;
+
+    switch (ev->type) {
+    case CreateNotify:
+        if (ev->xcreatewindow.parent == root) {
+            stack_remove(ev->xcreatewindow.window);
+            stack_insert(ev->xcreatewindow.window, stack_len);
+        }
+        break;
+
+    case DestroyNotify:
+        if (ev->xdestroywindow.event == root)
+            stack_remove(ev->xdestroywindow.window);
+        break;
+
+    case ConfigureNotify:
+        if (ev->xconfigure.event == root && ev->xconfigure.window != root)
+            stack_place_above(ev->xconfigure.window, ev->xconfigure.above);
+        break;
+
+    case ReparentNotify:
+        /* We see both a window leaving the root and one arriving on it. */
+        stack_remove(ev->xreparent.window);
+        if (ev->xreparent.parent == root)
+            stack_insert(ev->xreparent.window, stack_len);
+        break;
+
+    case CirculateNotify:
+        if (ev->xcirculate.event != root)
+            break;
+        stack_remove(ev->xcirculate.window);
+        stack_insert(ev->xcirculate.window,
+                     ev->xcirculate.place == PlaceOnTop ? stack_len : 0);
+        break;
+    }
+}
+
 /* When starting up scan existing windows and start managing them. */
 void scanwins(void)
 {
@@ -554,6 +1201,10 @@ void scanwins(void)
     XQueryTree(dpy, rp_glob_screen.root, &dw1, &dw2, &wins, &nwins);
     PRINT_DEBUG(("windows: %d\n", nwins));
 
+    stack_len = 0;
+    for (i = 0; i < nwins; i++)
+        stack_insert(wins[i], stack_len);
+
     for (i = 0; i < nwins; i++) {
         rp_screen *screen;
 
@@ -588,29 +1239,34 @@ void scanwins(void)
 
 int unmanaged_window(Window w)
 {
+    struct unmanaged_type *info;
+    rp_window *win;
     char *wname;
+    Atom type;
     int i;
 
     if (!unmanaged_window_list)
         return 0;
 
-    wname = get_wmname(w);
-    if (!wname)
+    /* Managed windows keep their name and type up to date already. */
+    if ((win = find_window(w))) {
+        wname = win->wm_name;
+        type = win->window_type;
+    } else if ((info = unmanaged_info(w))) {
+        wname = info->wm_name;
+        type = info->window_type;
+    } else
+        return 0;
+
+    if (wname == NULL)
         return 0;
 
     for (i = 0; i < num_unmanaged_windows; i++) {
-        if (!strcmp(unmanaged_window_list[i], wname)) {
-            free(wname);
+        if (!strcmp(unmanaged_window_list[i], wname))
             return 1;
-        }
     }
 
-    free(wname);
-
-    if (is_unmanaged_window_type(w))
-        return 1;
-
-    return 0;
+    return unmanaged_window_type(type);
 }
 
 /* Set the state of the window. */
@@ -619,6 +1275,7 @@ void set_state(rp_window *win, int state)
     unsigned long data[2];
 
     win->state = state;
+    snapshot_touch();
 
     data[0] = (long) win->state;
     data[1] = (long) None;
@@ -760,6 +1417,7 @@ static void maximize_window(rp_window *win, int transient)
     int maxw, maxh;
     float gap;
 
+    snapshot_touch();
     frame = win_get_frame(win);
 
     /* We can't maximize a window if it has no frame. */
@@ -874,15 +1532,13 @@ static void maximize_window(rp_window *win, int transient)
 }
 
 /*
- * Maximize the current window if data = 0, otherwise assume it is a pointer to
- * a window that should be maximized
+ * Work out where win belongs and configure it there. Unless force is set, a
+ * window that is already there is left alone. Nothing is synced.
  */
-void maximize(rp_window *win)
+static void place_window(rp_window *win, int force)
 {
-    if (!win)
-        win = current_window();
-    if (!win)
-        return;
+    int x = win->x, y = win->y, width = win->width, height = win->height;
+    int border = win->border;
 
     /* Handle maximizing transient and floated windows differently. */
     maximize_window(win, window_is_transient(win));
@@ -890,6 +1546,12 @@ void maximize(rp_window *win)
     /* Reposition the window. */
     move_window(win);
 
+    if (!force && x == win->x && y == win->y && width == win->width
+        && height == win->height && border == win->border) {
+        PRINT_DEBUG(("'%s' is already in place\n", window_name(win)));
+        return;
+    }
+
     PRINT_DEBUG(("Resizing %s window '%s' to x:%d y:%d w:%d h:%d\n",
                  win->transient ? "transient" : (win->floated ? "floated" :
                                                  "normal"),
@@ -900,10 +1562,33 @@ void maximize(rp_window *win)
     XMoveResizeWindow(dpy, win->w, win->x, win->y, win->width,
                       win->height);
     XSetWindowBorderWidth(dpy, win->w, win->border);
+}
+
+/*
+ * Maximize the current window if data = 0, otherwise assume it is a pointer to
+ * a window that should be maximized
+ */
+void maximize(rp_window *win)
+{
+    if (!win)
+        win = current_window();
+    if (!win)
+        return;
+
+    place_window(win, 1);
 
     XSync(dpy, False);
 }
 
+/*
+ * Maximize win for a batch of windows. It isn't configured if it's already in
+ * place, and the caller syncs once after the last one.
+ */
+void maximize_batched(rp_window *win)
+{
+    place_window(win, 0);
+}
+
 /*
  * Maximize the current window but don't treat transient windows differently.
  */
@@ -952,11 +1637,13 @@ void map_window(rp_window *win)
 
     PRINT_DEBUG(("Mapping the unmapped window %s\n", window_name(win)));
 
-    /* Fill in the necessary data about the window */
-    update_window_information(win);
+    /*
+     * add_to_window_list already read what we need to know about the
+     * window, and the events it selected keep that current.
+     */
 
     /* Check if this window should be floated */
-    if (floated_window(win->w))
+    if (floated_window(win))
         win->floated = 1;
 
     if (win->transient_for && (transfor = find_window(win->transient_for))) {
@@ -973,20 +1660,21 @@ void map_window(rp_window *win)
      */
     static int window_counter = 0;
     win->number = window_counter++;
-    grab_top_level_keys(win->w);
+    if (!defaults.root_key_grab)
+        grab_top_level_keys(win->w);
 
     /* Put win in the mapped window list */
     list_del(&win->node);
     insert_into_list(win, &rp_mapped_window);
 
-    vscreen_map_window(win->vscreen, win);
-
     /*
      * The window has never been accessed since it was brought back from the
      * Withdrawn state.
      */
     win->last_access = 0;
 
+    vscreen_map_window(win->vscreen, win);
+
     /* It is now considered iconic and set_active_window can handle the
      * rest. */
     set_state(win, IconicState);
@@ -1006,7 +1694,7 @@ void map_window(rp_window *win)
     /* Sync to ensure window is properly mapped before continuing */
     XSync(dpy, False);
 
-    hook_run(&rp_new_window_hook);
+    hook_run_window(&rp_new_window_hook, win);
 }
 
 void hide_window(rp_window *win)
@@ -1081,7 +1769,7 @@ void withdraw_window(rp_window *win)
     ignore_badwindow--;
 
     /* Call our hook */
-    hook_run(&rp_delete_window_hook);
+    hook_run_window(&rp_delete_window_hook, win);
 }
 
 /*
@@ -1134,22 +1822,42 @@ void hide_vscreen_windows(rp_vscreen *v)
 {
     rp_window *cur;
 
-    list_for_each_entry(cur, &rp_mapped_window, node)
-        if (cur->vscreen == v)
+    list_for_each_entry(cur, &rp_mapped_window, node) {
+        if (cur->vscreen != v)
+            continue;
+
+        /* It's not showing, there's nothing to tell the server. */
+        if (cur->state == IconicState) {
+            cur->frame_number = EMPTY;
+            continue;
+        }
+
         hide_window(cur);
+    }
 }
 
+/* Raise docks, notifications and the like above everything else. */
 void raise_utility_windows(void)
 {
-    unsigned int i, nwins;
-    Window dw1, dw2, *wins;
+    Window *raise;
+    int i, n = 0;
 
-    XQueryTree(dpy, rp_glob_screen.root, &dw1, &dw2, &wins, &nwins);
+    if (stack_len == 0)
+        return;
 
-    for (i = 0; i < nwins; i++) {
-        if (!is_rp_window(wins[i]) && is_unmanaged_window_type(wins[i]))
-            XRaiseWindow(dpy, wins[i]);
+    /* XRestackWindows wants them top to bottom. */
+    raise = xmalloc(sizeof(Window) * stack_len);
+    for (i = stack_len - 1; i >= 0; i--) {
+        if (!is_rp_window(stack_wins[i])
+            && is_unmanaged_window_type(stack_wins[i]))
+            raise[n++] = stack_wins[i];
     }
 
-    XFree(wins);
+    if (n > 0) {
+        XRaiseWindow(dpy, raise[0]);
+        if (n > 1)
+            XRestackWindows(dpy, raise, n);
+    }
+
+    free(raise);
 }
@@ -19,96 +19,91 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <err.h>
 
 #include "poison.h"
 
-/* Keep track of a set of numbers. For frames, vscreens, and screens. */
+#define NUMSET_WORD_BITS ((int) (sizeof(unsigned long) * CHAR_BIT))
+
+/* Numbers past this are refused rather than grow the bitmap without bound. */
+#define NUMSET_MAX (1 << 20)
+
+/*
+ * Keep track of a set of numbers. For frames, vscreens, and screens. Each
+ * number is a bit, so requesting the lowest free one is a matter of finding
+ * the first word with a clear bit.
+ */
 struct numset {
-    /* A list of the numbers taken. */
-    int *numbers_taken;
+    /* One bit for each number, set when the number is taken. */
+    unsigned long *bits;
 
-    /*
-     * the number of numbers currently stored in the numbers_taken array.
-     */
-    int num_taken;
+    /* The number of words in bits. */
+    int nwords;
 
-    /* the size of the numbers_taken array. */
-    int max_taken;
+    /* Every word before this one is full. */
+    int first_free;
 };
 
 /* Initialize a numset structure. */
 static void numset_init(struct numset *ns)
 {
-    ns->max_taken = 10;
-    ns->num_taken = 0;
-
-    ns->numbers_taken = xmalloc(ns->max_taken * sizeof(int));
+    ns->nwords = 1;
+    ns->first_free = 0;
+    ns->bits = xmalloc(ns->nwords * sizeof(unsigned long));
+    ns->bits[0] = 0;
 }
 
-static int numset_num_is_taken(struct numset *ns, int n)
+/* Make room for at least nwords words, with the new ones clear. */
+static void numset_grow(struct numset *ns, int nwords)
 {
-    int i;
+    int old = ns->nwords;
 
-    for (i = 0; i < ns->num_taken; i++) {
-        if (ns->numbers_taken[i] == n)
-            return 1;
-    }
-    return 0;
-}
-
-/* returns index into numbers_taken that can be used. */
-static int numset_find_empty_cell(struct numset *ns)
-{
-    int i;
-
-    for (i = 0; i < ns->num_taken; i++) {
-        if (ns->numbers_taken[i] == -1)
-            return i;
-    }
+    while (ns->nwords < nwords)
+        ns->nwords *= 2;
 
-    /* no vacant ones, so grow the array. */
-    if (ns->num_taken >= ns->max_taken) {
-        ns->max_taken *= 2;
-        ns->numbers_taken = xrealloc(ns->numbers_taken,
-                                     sizeof(int) * ns->max_taken);
-    }
-    ns->num_taken++;
-
-    return ns->num_taken - 1;
+    ns->bits = xrealloc(ns->bits, ns->nwords * sizeof(unsigned long));
+    memset(ns->bits + old, 0, (ns->nwords - old) * sizeof(unsigned long));
 }
 
 int numset_add_num(struct numset *ns, int n)
 {
-    int ec;
+    unsigned long bit;
+    int w;
+
+    if (n < 0 || n >= NUMSET_MAX)
+        return 0;               /* failed. */
+
+    w = n / NUMSET_WORD_BITS;
+    bit = 1UL << (n % NUMSET_WORD_BITS);
+    if (w >= ns->nwords)
+        numset_grow(ns, w + 1);
 
-    if (numset_num_is_taken(ns, n))
+    if (ns->bits[w] & bit)
         return 0;               /* failed. */
 
-    /*
-     * numset_find_empty_cell calls realloc on numbers_taken. So store the
-     * ret val in ec then use ec as an index into the array.
-     */
-    ec = numset_find_empty_cell(ns);
-    ns->numbers_taken[ec] = n;
+    ns->bits[w] |= bit;
     return 1;                   /* success! */
 }
 
 /*
- * Returns a unique number from the numset.
+ * Returns a unique number from the numset, the lowest one that is free.
  */
 int numset_request(struct numset *ns)
 {
-    int i;
+    int w, n;
 
-    /*
-     * look for a unique number, and add it to the list of taken numbers.
-     */
-    i = 0;
-    while (!numset_add_num(ns, i))
-        i++;
+    for (w = ns->first_free; w < ns->nwords && ns->bits[w] == ~0UL; w++) ;
+    ns->first_free = w;
 
-    return i;
+    if (w == ns->nwords)
+        numset_grow(ns, w + 1);
+
+    n = __builtin_ctzl(~ns->bits[w]);
+    ns->bits[w] |= 1UL << n;
+
+    return w * NUMSET_WORD_BITS + n;
 }
 
 /*
@@ -116,17 +111,20 @@ int numset_request(struct numset *ns)
  */
 void numset_release(struct numset *ns, int n)
 {
-    int i;
+    int w;
 
-    if (n < 0)
+    if (n < 0) {
         warnx("ns=%p attempt to release %d!", ns, n);
-
-    for (i = 0; i < ns->num_taken; i++) {
-        if (ns->numbers_taken[i] == n) {
-            ns->numbers_taken[i] = -1;
-            return;
-        }
+        return;
     }
+
+    w = n / NUMSET_WORD_BITS;
+    if (w >= ns->nwords)
+        return;
+
+    ns->bits[w] &= ~(1UL << (n % NUMSET_WORD_BITS));
+    if (w < ns->first_free)
+        ns->first_free = w;
 }
 
 /* Create a new numset and return a pointer to it. */
@@ -142,6 +140,6 @@ struct numset *numset_new(void)
 /* Free a numset structure and its internal data. */
 void numset_free(struct numset *ns)
 {
-    free(ns->numbers_taken);
+    free(ns->bits);
     free(ns);
 }
@@ -163,6 +163,7 @@ static void init_defaults(void)
 
     defaults.ignore_resize_hints = 0;
     defaults.win_add_cur_vscreen = 0;
+    defaults.root_key_grab = 0;
 }
 
 static void init_shape(void)
@@ -251,6 +252,7 @@ int main(int argc, char *argv[])
     /* For child processes to know */
     snprintf(pid, sizeof(pid), "%d", getpid());
     setenv("POISON_PID", pid, 1);
+    init_control();
 
     /* Must be first */
     register_atom(&_net_supported, "_NET_SUPPORTED");
@@ -27,11 +27,11 @@
 #include <X11/Xatom.h>
 #include <X11/Xlocale.h>
 #include <X11/Xmd.h>
-#include <X11/extensions/XRes.h>
 #include <X11/X.h>
 #include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #if defined(__BASE_FILE__)
 #define RP_FILE_NAME __BASE_FILE__
@@ -364,11 +364,17 @@ int numset_add_num(struct numset *ns, int n);
 
 #include <stdlib.h>
 
+/* Strings shorter than this are kept in the sbuf itself. */
+#define SBUF_INLINE 32
+
 struct sbuf {
     char *data;
     size_t len;
     size_t maxsz;
 
+    /* data points here until the string outgrows it. */
+    char small[SBUF_INLINE];
+
     /* sbuf can exist in a list. */
     struct list_head node;
 };
@@ -385,6 +391,7 @@ char *sbuf_get(struct sbuf *b);
 char *sbuf_printf(struct sbuf *b, char *fmt, ...);
 char *sbuf_printf_concat(struct sbuf *b, char *fmt, ...);
 void sbuf_chop(struct sbuf *b);
+void sbuf_drop(struct sbuf *b, size_t n);
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
@@ -398,10 +405,13 @@ typedef struct rp_vscreen rp_vscreen;
 typedef struct rp_action rp_action;
 typedef struct rp_keymap rp_keymap;
 typedef struct rp_frame rp_frame;
+typedef struct rp_split rp_split;
 typedef struct rp_child_info rp_child_info;
 typedef struct rp_window_elem rp_window_elem;
 typedef struct rp_completions rp_completions;
 typedef struct rp_input_line rp_input_line;
+typedef struct rp_compiled_cmd rp_compiled_cmd;
+typedef struct rp_format rp_format;
 
 enum rp_edge {
     EDGE_TOP = (1 << 1),
@@ -410,6 +420,15 @@ enum rp_edge {
     EDGE_BOTTOM = (1 << 4),
 };
 
+/* The sides of a frame, for looking frames up by where they are. */
+enum rp_side {
+    SIDE_TOP,
+    SIDE_LEFT,
+    SIDE_RIGHT,
+    SIDE_BOTTOM,
+    SIDES
+};
+
 struct rp_frame {
     rp_vscreen *vscreen;
 
@@ -434,9 +453,25 @@ struct rp_frame {
     /* Whether this frame is touching an edge before a screen update */
     enum rp_edge edges;
 
+    /* The frame's leaf in the split tree, if there is one. */
+    rp_split *split;
+
     struct list_head node;
 };
 
+/*
+ * A node of the split tree of a vscreen, see split.c. Leaves have a frame,
+ * the others cut their rectangle in two along way, side by side or one
+ * above the other, and the first child gets ratio of it.
+ */
+struct rp_split {
+    rp_split *parent, *child[2];
+    rp_frame *frame;
+    int way;
+    double ratio;
+    int x, y, width, height;
+};
+
 struct rp_window {
     rp_vscreen *vscreen;
     Window w;
@@ -483,6 +518,20 @@ struct rp_window {
     /* Is this a floated window? */
     int floated;
 
+    /*
+     * Cached _NET_WM_WINDOW_TYPE, and the process behind _NET_WM_PID and
+     * WM_CLIENT_MACHINE. property_notify refreshes these when the
+     * properties change.
+     */
+    Atom window_type;
+    unsigned long pid;
+    int pid_local;
+    int pid_cached;
+
+    /* Format escapes expanded for this window, see format.c. */
+    unsigned int fmt_generation;
+    struct rp_format_memo *fmt_memo;
+
     /* Saved mouse position */
     int mouse_x, mouse_y;
 
@@ -507,6 +556,17 @@ struct rp_window {
      */
     int intended_frame_number;
 
+    /*
+     * The frame showing this window, or NULL. Only good while
+     * shown_generation is the frames_generation of the window's vscreen,
+     * see find_windows_frame().
+     */
+    rp_frame *shown_in;
+    unsigned long shown_generation;
+
+    /* The window's entry in the window lists of its vscreen. */
+    rp_window_elem *elem;
+
     struct list_head node;
 };
 
@@ -514,6 +574,13 @@ struct rp_window_elem {
     rp_window *win;
     int number;
     struct list_head node;
+
+    /*
+     * The vscreen whose lists this is in, and its place among that
+     * vscreen's mapped windows by when they were last focused.
+     */
+    rp_vscreen *vscreen;
+    struct list_head mru;
 };
 
 struct rp_global_screen {
@@ -552,6 +619,21 @@ struct rp_vscreen {
     /* Keep track of which numbers have been given to frames. */
     struct numset *frames_numset;
 
+    /*
+     * The frames sorted by where each of their sides is, so the ones
+     * touching a side can be found without looking at all of them. Only
+     * good while frame_index_valid is set, see frames_changed().
+     */
+    rp_frame **frame_index[SIDES];
+    int frame_index_len, frame_index_size, frame_index_valid;
+
+    /*
+     * How the frames were split, or NULL if it's not known. It's worked out
+     * from the frames again when split_tree_stale is set.
+     */
+    rp_split *split_tree;
+    int split_tree_stale;
+
     /*
      * The number of the currently focused frame. One for each vscreen so
      * when you switch vscreens the focus doesn't get frobbed.
@@ -561,6 +643,12 @@ struct rp_vscreen {
     /* The list of windows participating in this vscreen. */
     struct list_head mapped_windows, unmapped_windows;
 
+    /* The mapped windows again, the most recently focused first. */
+    struct list_head mru_windows;
+
+    /* Changes when frames are freed or replaced, see find_windows_frame(). */
+    unsigned long frames_generation;
+
     /*
      * This numset is responsible for giving out numbers for each window in
      * the vscreen.
@@ -575,6 +663,62 @@ struct rp_font {
     XftFont *font;
 };
 
+/*
+ * A pixmap to draw into before copying to a window. It is also installed as
+ * the window's background after each draw, so exposures repaint themselves.
+ * The server may keep its own copy of a background, so drawing into the
+ * pixmap alone doesn't update it.
+ */
+struct rp_back_buffer {
+    Pixmap pixmap;
+    int width, height;
+    XftDraw *draw;
+    GC gc;
+};
+
+/* The bar's back buffer, and what it showed last. */
+struct rp_bar_buffer {
+    struct rp_back_buffer back;
+
+    /* What the bar window shows, or NULL if it must be redrawn. */
+    char *text;
+    int mark_start, mark_end;
+    int x, y, width, height;
+};
+
+/*
+ * A string as glyphs of one font, ready to be measured or drawn. Each screen
+ * keeps the GLYPH_CACHE_SIZE most recently used ones.
+ */
+#define GLYPH_CACHE_SIZE 256
+#define GLYPH_CACHE_BUCKETS 128
+
+struct rp_glyph_run {
+    XftFont *font;
+    unsigned int hash;
+    char *string;
+    int length;
+
+    FT_UInt *glyphs;
+    int nglyphs;
+    int width;
+
+    /* Most recently used first. */
+    struct list_head lru;
+    struct rp_glyph_run *next;
+};
+
+/*
+ * A color named in a draw call, allocated once. A name that couldn't be
+ * allocated is kept as bad, so it is only tried and warned about once.
+ */
+struct rp_color {
+    char *name;
+    XftColor color;
+    int bad;
+    struct list_head node;
+};
+
 struct rp_screen {
     GC normal_gc, inverse_gc;
     Window root, bar_window, key_window, input_window, frame_window,
@@ -600,6 +744,11 @@ struct rp_screen {
     XftFont *xft_font;
     struct rp_font xft_font_cache[5];
     XftColor xft_fgcolor, xft_bgcolor;
+    struct list_head xft_colors;
+
+    /* Kept for the lifetime of the windows they draw on. */
+    XftDraw *frame_draw, *help_draw;
+    struct rp_back_buffer input_buf;
 
     struct list_head vscreens;
     struct numset *vscreens_numset;
@@ -608,6 +757,12 @@ struct rp_screen {
     rp_window *full_screen_win;
 
     struct sbuf *bar_text;
+    struct rp_bar_buffer bar_buf;
+
+    struct rp_glyph_run *glyph_buckets[GLYPH_CACHE_BUCKETS];
+    struct list_head glyph_lru;
+    int glyph_count;
+    unsigned long glyph_hits, glyph_misses;
 
     /* This structure can exist in a list. */
     struct list_head node;
@@ -617,6 +772,7 @@ struct rp_action {
     KeySym key;
     unsigned int state;
     char *data;                 /* misc data to be passed to the function */
+    rp_compiled_cmd *compiled;  /* data, ready to run */
     /* void (*func)(void *); */
 };
 
@@ -626,6 +782,13 @@ struct rp_keymap {
     int actions_last;
     int actions_size;
 
+    /*
+     * Open addressed hash on (key, state) holding indices into actions,
+     * or -1 for an empty slot. Always twice the size of actions.
+     */
+    int *index;
+    int index_size;
+
     /* This structure can be part of a list. */
     struct list_head node;
 };
@@ -710,6 +873,9 @@ struct rp_defaults {
 
     /* New mapped window always uses current vscreen */
     int win_add_cur_vscreen;
+
+    /* Grab top level keys on the root window instead of each client */
+    int root_key_grab;
 };
 
 /* Information about a child process. */
@@ -822,6 +988,24 @@ struct rp_input_line {
     size_t size;
     rp_completions *compl;
     Atom selection;
+
+    /*
+     * What the input window showed after the last redraw, so the next one
+     * only draws what changed. drawn is NULL before the first.
+     */
+    char *drawn;
+    size_t drawn_length;
+    size_t drawn_position;
+    int drawn_width;
+};
+
+/* A command attached to a hook, compiled when it was added. */
+struct rp_hook_cmd {
+    char *cmd;
+    rp_compiled_cmd *compiled;
+
+    /* This structure can exist in a list. */
+    struct list_head node;
 };
 
 /* The hook dictionary. */
@@ -1014,9 +1198,18 @@ char *get_selection(void);
 
 XftFont *rp_get_font(rp_screen * s, char *font);
 void rp_clear_cached_fonts(rp_screen * s);
+void rp_draw_string_on(rp_screen * s, XftDraw * draw, int style, int x,
+                       int y, char *string, int length, char *font,
+                       char *color);
 void rp_draw_string(rp_screen * s, Drawable d, int style, int x, int y,
                     char *string, int length, char *font, char *color);
 int rp_text_width(rp_screen * s, char *string, int count, char *font);
+void flush_glyph_cache(rp_screen * s);
+void rp_free_cached_colors(rp_screen * s);
+int back_buffer_reserve(rp_screen * s, struct rp_back_buffer *b, int width,
+                        int height);
+void back_buffer_free(struct rp_back_buffer *b);
+void glyph_cache_stats(struct sbuf *buf);
 
 void check_child_procs(void);
 void chld_handler(int signum);
@@ -1044,8 +1237,9 @@ int unmanaged_window(Window w);
 void clear_floated_list(void);
 char *list_floated_windows(void);
 void add_floated_window(char *name);
-int floated_window(Window w);
+int floated_window(rp_window * win);
 void scanwins(void);
+void stacking_notify(XEvent * ev);
 void unmanage(rp_window * w);
 int update_window_name(rp_window * win);
 void update_normal_hints(rp_window * win);
@@ -1057,13 +1251,18 @@ void check_state(rp_window * win);
 int window_is_transient(rp_window * win);
 Atom get_net_wm_window_type(rp_window * win);
 int is_unmanaged_window_type(Window win);
+void update_window_type(rp_window * win);
+void forget_window_type(Window w);
 void update_window_information(rp_window * win);
+void update_window_pid(rp_window * win);
+void update_window_transient(rp_window * win);
 void update_window_input_hint(rp_window * win);
 void update_window_protocols(rp_window * win);
 void cleanup_withdrawn_windows(void);
 void map_window(rp_window * win);
 
 void maximize(rp_window * win);
+void maximize_batched(rp_window * win);
 void force_maximize(rp_window * win);
 
 void grab_top_level_keys(Window w);
@@ -1108,7 +1307,7 @@ void free_window_stuff(void);
 
 rp_frame *win_get_frame(rp_window * win);
 
-struct rp_child_info *get_child_info(Window w, int add);
+struct rp_child_info *get_child_info(rp_window * win, int add);
 void change_windows_vscreen(rp_vscreen * v, rp_vscreen * new_vscreen);
 
 void window_full_screen(rp_window * win);
@@ -1138,6 +1337,8 @@ void marked_message_printf(int mark_start, int mark_end, char *fmt, ...);
 void redraw_last_message(void);
 void show_last_message(void);
 void free_bar(void);
+void invalidate_bar(rp_screen * s);
+void free_bar_buffer(rp_screen * s);
 
 void listen_for_events(void);
 void show_rudeness_msg(rp_window * win, int raised);
@@ -1150,9 +1351,9 @@ char *get_more_input(char *prompt, char *preinput,
                      enum completion_styles style, completion_fn fn);
 void read_any_key(void);
 int read_single_key(KeySym * keysym, unsigned int *modifiers,
-                    char *keysym_name, int len);
+                    char *keysym_name, int len, int traced);
 int read_key(KeySym * keysym, unsigned int *modifiers, char *keysym_name,
-             int len);
+             int len, int traced);
 unsigned int x11_mask_to_rp_mask(unsigned int mask);
 unsigned int rp_mask_to_x11_mask(unsigned int mask);
 void update_modifier_map(void);
@@ -1171,6 +1372,11 @@ void resize_shrink_to_window(rp_frame * frame);
 void resize_frame_horizontally(rp_frame * frame, int diff);
 void resize_frame_vertically(rp_frame * frame, int diff);
 void remove_frame(rp_frame * frame);
+void frames_changed(rp_vscreen * v);
+void frame_windows_changed(rp_vscreen * v);
+void frame_side_moved(rp_frame * frame, int side, int old);
+void split_tree_forget(rp_vscreen * v);
+int split_tree_fit(rp_vscreen * v, int rescale);
 rp_window *find_window_for_frame(rp_frame * frame);
 rp_frame *find_windows_frame(rp_window * win);
 int num_frames(rp_vscreen * v);
@@ -1202,6 +1408,7 @@ void frame_resize_left(rp_frame * frame, int amount);
 void mark_edge_frames(void);
 int frame_height(rp_frame * frame);
 int frame_width(rp_frame * frame);
+int frame_side(rp_frame * frame, int side);
 int frame_bottom(rp_frame * frame);
 int frame_bottom_screen_edge(rp_frame * frame);
 int frame_right(rp_frame * frame);
@@ -1220,6 +1427,8 @@ void frame_free(rp_vscreen * v, rp_frame * f);
 rp_frame *frame_copy(rp_frame * frame);
 char *frame_dump(rp_frame * frame, rp_vscreen * vscreen);
 rp_frame *frame_read(char *str, rp_vscreen * vscreen);
+rp_frame *frame_make(rp_vscreen * vscreen);
+void frame_fit(rp_frame * f, int s_width, int s_height, Window w);
 
 rp_vscreen *frames_vscreen(rp_frame *);
 
@@ -1289,6 +1498,7 @@ void vscreen_del_window(rp_vscreen * v, rp_window * win);
 void vscreen_map_window(rp_vscreen * v, rp_window * win);
 
 void vscreen_unmap_window(rp_vscreen * v, rp_window * win);
+void vscreen_window_accessed(rp_window * win);
 
 struct numset *vscreen_get_numset(rp_vscreen * v);
 void get_vscreen_list(rp_screen * s, char *delim, struct sbuf *buffer,
@@ -1355,12 +1565,58 @@ rp_completions *completions_new(completion_fn list_fn,
 void completions_free(rp_completions * c);
 
 void hook_run(struct list_head *hook);
-void hook_remove(struct list_head *hook, struct sbuf *s);
-void hook_add(struct list_head *hook, struct sbuf *s);
+void hook_run_window(struct list_head *hook, rp_window * win);
+void hook_remove(struct list_head *hook, char *cmd);
+void hook_add(struct list_head *hook, char *cmd);
 struct list_head *hook_lookup(char *s);
 
+rp_format *format_compile(char *fmt);
+void format_run(rp_format * prog, rp_window_elem * win_elem,
+                struct sbuf *buffer);
 void format_string(char *fmt, rp_window_elem * win_elem,
                    struct sbuf *buffer);
+void format_invalidate(rp_window * win);
+void format_invalidate_all(void);
+void format_focus_changed(void);
+void format_forget_window(rp_window * win);
+void free_formats(void);
+
+/* The stages of handling an event that latency tracing records. */
+enum latency_stage {
+    LAT_DEQUEUE,                /* taken off the event queue */
+    LAT_COOKED,                 /* key translated to a keysym */
+    LAT_LOOKUP,                 /* binding found */
+    LAT_DISPATCH,               /* bound command about to run */
+    LAT_REQUEST,                /* first X request issued */
+    LAT_HANDLED,                /* event handler returned */
+    LAT_FLUSHED,                /* requests flushed and processed */
+    LAT_NSTAGES
+};
+
+void latency_enable(int on);
+int latency_enabled(void);
+void latency_reset(void);
+void latency_begin(XEvent * ev);
+void latency_cancel(void);
+void latency_mark(int stage);
+void latency_end(void);
+void latency_summary(struct sbuf *buf);
+void latency_csv(struct sbuf *buf);
+
+/* The most command socket clients connected at once. */
+#define CONTROL_MAX_CLIENTS 64
+
+void init_control(void);
+int control_pollfds(struct pollfd *pfd);
+void control_dispatch(struct pollfd *pfd, int n);
+void control_event(struct list_head *hook, rp_window * win);
+void control_flush_events(void);
+void free_control(void);
+
+void snapshot_touch(void);
+unsigned long snapshot_generation(void);
+char *snapshot_dump(void);
+void free_snapshot(void);
 
 #define __dead	__attribute__((__noreturn__))
 
@@ -1433,6 +1689,9 @@ rp_keymap *find_keymap(char *name);
 void init_user_commands(void);
 void initialize_default_keybindings(void);
 cmdret *command(int interactive, char *data);
+rp_compiled_cmd *command_compile(char *data);
+cmdret *command_run(int interactive, rp_compiled_cmd * cc);
+void command_compiled_free(rp_compiled_cmd * cc);
 cmdret *cmdret_new(int success, char *fmt, ...);
 void cmdret_free(cmdret * ret);
 void free_user_commands(void);
@@ -1450,5 +1709,7 @@ int xrandr_query_screen(int **outputs);
 int xrandr_is_primary(rp_screen * screen);
 void xrandr_fill_screen(int rr_output, rp_screen * screen);
 void xrandr_notify(XEvent * ev);
+int xrandr_settle_timeout(void);
+void xrandr_settle(void);
 
 #endif                          /* ! _POISON_H */
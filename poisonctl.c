@@ -0,0 +1,255 @@
+/*
+ * poisonctl - run poison commands through its command socket
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+/*
+ * With arguments, they are joined into one command. Without, every line of
+ * standard input is a command. All of them are sent without waiting for the
+ * replies, which are read back as they come. Output goes to standard output,
+ * or standard error for commands that failed, and the exit status is 1 if any
+ * of them did.
+ *
+ * With -e, the arguments name event classes instead, and the events are
+ * printed as they come until poison goes away.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static void buffer_append(struct buffer *b, const char *data, size_t len)
+{
+    if (b->len + len + 1 > b->size) {
+        b->size = (b->len + len + 1) * 2;
+        if ((b->data = realloc(b->data, b->size)) == NULL)
+            err(1, "realloc");
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+static void buffer_drop(struct buffer *b, size_t n)
+{
+    memmove(b->data, b->data + n, b->len - n + 1);
+    b->len -= n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: poisonctl [-s socket] [command [arg ...]]\n");
+    fprintf(stderr, "       poisonctl [-s socket] -e [class ...]\n");
+    exit(2);
+}
+
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        errx(2, "socket path too long: %s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err(2, "socket");
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        err(2, "connect %s", path);
+
+    /*
+     * poison stops reading while we leave too many replies unread, so we
+     * must never block in write() with replies waiting.
+     */
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+        err(2, "fcntl");
+
+    return fd;
+}
+
+/*
+ * Print up to max complete replies in in. Return how many there were and
+ * count the failed ones in failed.
+ */
+static int print_replies(struct buffer *in, int max, int *failed)
+{
+    char *nl, *end;
+    size_t len, header;
+    int ok, n = 0;
+
+    while (n < max && in->len && (nl = memchr(in->data, '\n', in->len))) {
+        if (!strncmp(in->data, "ok ", 3))
+            ok = 1;
+        else if (!strncmp(in->data, "error ", 6))
+            ok = 0;
+        else
+            errx(1, "bad reply from poison");
+
+        len = strtoul(strchr(in->data, ' ') + 1, &end, 10);
+        if (end != nl)
+            errx(1, "bad reply from poison");
+
+        header = nl - in->data + 1;
+        if (in->len - header < len)
+            break;
+
+        fwrite(in->data + header, 1, len, ok ? stdout : stderr);
+        if (len && in->data[header + len - 1] != '\n')
+            fputc('\n', ok ? stdout : stderr);
+        if (!ok)
+            (*failed)++;
+
+        buffer_drop(in, header + len);
+        n++;
+    }
+
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    struct buffer out = { NULL, 0, 0 }, in = { NULL, 0, 0 };
+    struct pollfd pfd;
+    const char *path = NULL;
+    char buf[8192];
+    ssize_t n;
+    size_t i;
+    int c, expected = 0, replies = 0, failed = 0, shut = 0, watch = 0;
+
+    while ((c = getopt(argc, argv, "es:h")) != -1) {
+        switch (c) {
+        case 'e':
+            watch = 1;
+            break;
+        case 's':
+            path = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (path == NULL && (path = getenv("POISON_SOCKET")) == NULL)
+        errx(2, "POISON_SOCKET is not set, use -s");
+
+    /* Build every request before sending anything. */
+    if (watch) {
+        buffer_append(&out, "subscribe", 9);
+        for (c = 0; c < argc; c++) {
+            buffer_append(&out, " ", 1);
+            buffer_append(&out, argv[c], strlen(argv[c]));
+        }
+        buffer_append(&out, "\n", 1);
+    } else if (argc) {
+        for (c = 0; c < argc; c++) {
+            if (c)
+                buffer_append(&out, " ", 1);
+            buffer_append(&out, argv[c], strlen(argv[c]));
+        }
+        buffer_append(&out, "\n", 1);
+    } else {
+        while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+            buffer_append(&out, buf, n);
+        if (n < 0)
+            err(2, "read");
+        if (out.len && out.data[out.len - 1] != '\n')
+            buffer_append(&out, "\n", 1);
+    }
+    for (i = 0; i < out.len; i++)
+        if (out.data[i] == '\n')
+            expected++;
+
+    signal(SIGPIPE, SIG_IGN);
+    pfd.fd = connect_socket(path);
+
+    while (replies < expected) {
+        /* poison would drop a subscriber that hung up its end. */
+        if (!shut && !watch && out.len == 0) {
+            shutdown(pfd.fd, SHUT_WR);
+            shut = 1;
+        }
+
+        pfd.events = POLLIN | (out.len ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            err(2, "poll");
+        }
+
+        if (pfd.revents & POLLOUT) {
+            if ((n = write(pfd.fd, out.data, out.len)) >= 0)
+                buffer_drop(&out, n);
+            else if (errno != EAGAIN && errno != EINTR)
+                err(2, "write");
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            if ((n = read(pfd.fd, buf, sizeof(buf))) < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                err(2, "read");
+            }
+            if (n == 0)
+                break;
+            buffer_append(&in, buf, n);
+            replies += print_replies(&in, expected - replies, &failed);
+        }
+    }
+
+    if (replies < expected)
+        errx(2, "poison closed the connection");
+
+    /* Whatever follows the reply to subscribe is events. */
+    if (watch && !failed) {
+        fwrite(in.data, 1, in.len, stdout);
+        fflush(stdout);
+        while ((n = read(pfd.fd, buf, sizeof(buf))) != 0) {
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR)
+                    err(2, "read");
+                pfd.events = POLLIN;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            fwrite(buf, 1, n, stdout);
+            fflush(stdout);
+        }
+    }
+
+    close(pfd.fd);
+
+    return failed ? 1 : 0;
+}
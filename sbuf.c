@@ -17,30 +17,54 @@
  * Place, Suite 330, Boston, MA 02111-1307 USA.
  */
 
+#include <stdio.h>
 #include <string.h>
 
 #include "poison.h"
 
-struct sbuf *sbuf_new(size_t initsz)
+/*
+ * Make room for a string of minsz bytes, counting the terminator. The buffer
+ * at least doubles each time, so building a string piece by piece costs
+ * linear time overall.
+ */
+static void sbuf_reserve(struct sbuf *b, size_t minsz)
 {
-    struct sbuf *b = xmalloc(sizeof(struct sbuf));
+    size_t newsz;
 
-    if (initsz < 1)
-        initsz = 1;
+    if (b->maxsz >= minsz)
+        return;
+
+    newsz = b->maxsz * 2;
+    if (newsz < minsz)
+        newsz = minsz;
+
+    if (b->data == b->small) {
+        b->data = xmalloc(newsz);
+        memcpy(b->data, b->small, b->len + 1);
+    } else
+        b->data = xrealloc(b->data, newsz);
+    b->maxsz = newsz;
+}
 
-    b->data = xmalloc(initsz);
-    b->maxsz = initsz;
+struct sbuf *sbuf_new(size_t initsz)
+{
+    struct sbuf *b = xmalloc(sizeof(struct sbuf));
 
+    b->data = b->small;
+    b->maxsz = SBUF_INLINE;
     b->data[0] = '\0';
     b->len = 0;
 
+    sbuf_reserve(b, initsz);
+
     return b;
 }
 
 void sbuf_free(struct sbuf *b)
 {
     if (b != NULL) {
-        free(b->data);
+        if (b->data != b->small)
+            free(b->data);
         free(b);
     }
 }
@@ -50,7 +74,10 @@ char *sbuf_free_struct(struct sbuf *b)
 {
     if (b != NULL) {
         char *tmp;
-        tmp = b->data;
+        if (b->data == b->small)
+            tmp = xstrdup(b->small);
+        else
+            tmp = b->data;
         free(b);
         return tmp;
     }
@@ -59,14 +86,9 @@ char *sbuf_free_struct(struct sbuf *b)
 
 char *sbuf_nconcat(struct sbuf *b, const char *str, int len)
 {
-    size_t minsz = b->len + len + 1;
-
-    if (b->maxsz < minsz) {
-        b->data = xrealloc(b->data, minsz);
-        b->maxsz = minsz;
-    }
-    memcpy(b->data + b->len, str, minsz - b->len - 1);
-    b->len = minsz - 1;
+    sbuf_reserve(b, b->len + len + 1);
+    memcpy(b->data + b->len, str, len);
+    b->len += len;
     *(b->data + b->len) = 0;
 
     return b->data;
@@ -95,34 +117,53 @@ char *sbuf_get(struct sbuf *b)
     return b->data;
 }
 
+/* Format straight into the spare room at the end of the buffer. */
+static char *sbuf_vprintf_concat(struct sbuf *b, char *fmt, va_list ap)
+{
+    va_list ap_copy;
+    int nchars;
+
+    while (1) {
+        va_copy(ap_copy, ap);
+        nchars = vsnprintf(b->data + b->len, b->maxsz - b->len, fmt,
+                           ap_copy);
+        va_end(ap_copy);
+
+        if (nchars < 0) {
+            b->data[b->len] = '\0';
+            return sbuf_concat(b, "<FAILURE>");
+        }
+        if ((size_t) nchars < b->maxsz - b->len)
+            break;
+
+        sbuf_reserve(b, b->len + nchars + 1);
+    }
+    b->len += nchars;
+
+    return b->data;
+}
+
 char *sbuf_printf(struct sbuf *b, char *fmt, ...)
 {
     va_list ap;
 
-    free(b->data);
+    sbuf_clear(b);
 
     va_start(ap, fmt);
-    b->data = xvsprintf(fmt, ap);
+    sbuf_vprintf_concat(b, fmt, ap);
     va_end(ap);
 
-    b->len = strlen(b->data);
-    b->maxsz = b->len + 1;
-
     return b->data;
 }
 
 char *sbuf_printf_concat(struct sbuf *b, char *fmt, ...)
 {
-    char *buffer;
     va_list ap;
 
     va_start(ap, fmt);
-    buffer = xvsprintf(fmt, ap);
+    sbuf_vprintf_concat(b, fmt, ap);
     va_end(ap);
 
-    sbuf_concat(b, buffer);
-    free(buffer);
-
     return b->data;
 }
 
@@ -142,7 +183,7 @@ char *sbuf_utf8_nconcat(struct sbuf *b, const char *s, int width)
                 len++;
             nchars++;
         }
-        sbuf_printf_concat(b, "%.*s", len, s);
+        sbuf_nconcat(b, s, len);
     } else
         sbuf_concat(b, s);
 
@@ -155,3 +196,12 @@ void sbuf_chop(struct sbuf *b)
         b->data[--(b->len)] = '\0';
     }
 }
+
+/* Remove the first n bytes. */
+void sbuf_drop(struct sbuf *b, size_t n)
+{
+    if (n > b->len)
+        n = b->len;
+    memmove(b->data, b->data + n, b->len - n + 1);
+    b->len -= n;
+}
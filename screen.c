@@ -435,11 +435,20 @@ static void init_screen(rp_screen *s)
              &_net_wm_window_type_splash, 1);
     XSelectInput(dpy, s->help_window, KeyPressMask);
 
+    s->frame_draw = XftDrawCreate(dpy, s->frame_window,
+                                  DefaultVisual(dpy, screen_num),
+                                  DefaultColormap(dpy, screen_num));
+    s->help_draw = XftDrawCreate(dpy, s->help_window,
+                                 DefaultVisual(dpy, screen_num),
+                                 DefaultColormap(dpy, screen_num));
+    INIT_LIST_HEAD(&s->xft_colors);
+
     activate_screen(s);
 
     XSync(dpy, 0);
 
     INIT_LIST_HEAD(&s->vscreens);
+    INIT_LIST_HEAD(&s->glyph_lru);
     s->vscreens_numset = numset_new();
 
     for (x = 0; x < defaults.vscreens; x++) {
@@ -502,8 +511,7 @@ char *screen_dump(rp_screen *screen)
         );
 
     /* Extract the string and return it, and don't forget to free s. */
-    tmp = sbuf_get(s);
-    free(s);
+    tmp = sbuf_free_struct(s);
     return tmp;
 }
 
@@ -546,6 +554,8 @@ void screen_update(rp_screen *s, int left, int top, int width, int height)
     rp_vscreen *v;
     int oldwidth, oldheight;
 
+    snapshot_touch();
+
     PRINT_DEBUG(("screen_update (left=%d, top=%d, width=%d, height=%d)\n",
                  left, top, width, height));
 
@@ -561,6 +571,10 @@ void screen_update(rp_screen *s, int left, int top, int width, int height)
                       s->height);
 
     list_for_each_entry(v, &s->vscreens, node) {
+        /* Keep the proportions of the splits where they are known. */
+        if (split_tree_fit(v, 1))
+            continue;
+
         list_for_each_entry(f, &v->frames, node) {
             f->x = (f->x * width) / oldwidth;
             f->width = (f->width * width) / oldwidth;
@@ -568,6 +582,8 @@ void screen_update(rp_screen *s, int left, int top, int width, int height)
             f->height = (f->height * height) / oldheight;
             maximize_all_windows_in_frame(f);
         }
+        frames_changed(v);
+        split_tree_forget(v);
     }
 
     screen_update_workarea(s);
@@ -580,6 +596,9 @@ void screen_update_frames(rp_screen *s)
     int diff;
 
     list_for_each_entry(v, &s->vscreens, node) {
+        if (split_tree_fit(v, 0))
+            continue;
+
         list_for_each_entry(f, &v->frames, node) {
             if (frame_left_screen_edge(f) || (f->edges & EDGE_LEFT)) {
                 diff = screen_left(v->screen) - f->x;
@@ -601,6 +620,8 @@ void screen_update_frames(rp_screen *s)
 
             maximize_all_windows_in_frame(f);
         }
+        frames_changed(v);
+        split_tree_forget(v);
     }
 }
 
@@ -623,6 +644,7 @@ rp_screen *screen_add(int rr_output)
     screen = xmalloc(sizeof(*screen));
     memset(screen, 0, sizeof(*screen));
     list_add(&screen->node, &rp_screens);
+    snapshot_touch();
 
     screen->number = numset_request(rp_glob_screen.numset);
 
@@ -642,6 +664,8 @@ void screen_del(rp_screen *s)
     rp_vscreen *v;
     struct list_head *iter, *tmp;
 
+    snapshot_touch();
+
     if (s == rp_current_screen) {
         if (screen_count() == 1) {
             list_for_each_safe_entry(v, iter, tmp, &s->vscreens, node)
@@ -675,6 +699,14 @@ void screen_free(rp_screen *s)
 {
     deactivate_screen(s);
 
+    free_bar_buffer(s);
+    back_buffer_free(&s->input_buf);
+    if (s->frame_draw)
+        XftDrawDestroy(s->frame_draw);
+    if (s->help_draw)
+        XftDrawDestroy(s->help_draw);
+    rp_free_cached_colors(s);
+
     XDestroyWindow(dpy, s->bar_window);
     XDestroyWindow(dpy, s->key_window);
     XDestroyWindow(dpy, s->input_window);
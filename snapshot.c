@@ -0,0 +1,187 @@
+/*
+ * A snapshot of the whole window manager state.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA.
+ */
+
+/*
+ * The snapshot is one s-expression in the style of frame_dump, with a line
+ * for each screen, vscreen, frame and window and one for the focus. Code
+ * that changes any of those calls snapshot_touch(), which bumps the
+ * generation. A snapshot is only rebuilt when the generation moved since the
+ * last one, and clients that pass the generation they have are told when
+ * nothing changed instead of getting it all again.
+ */
+
+#include <string.h>
+
+#include "poison.h"
+
+static unsigned long generation = 1;
+
+/* The last snapshot, and the generation it was built for. */
+static struct sbuf *cached;
+static unsigned long cached_generation;
+
+void snapshot_touch(void)
+{
+    generation++;
+}
+
+unsigned long snapshot_generation(void)
+{
+    return generation;
+}
+
+/* Append str quoted, or nil when there is none. */
+static void snapshot_string(struct sbuf *s, const char *str)
+{
+    const char *p, *start;
+
+    if (str == NULL) {
+        sbuf_concat(s, "nil");
+        return;
+    }
+
+    sbuf_concat(s, "\"");
+    for (p = start = str; *p; p++) {
+        if (*p != '"' && *p != '\\' && *p != '\n')
+            continue;
+        sbuf_nconcat(s, start, p - start);
+        sbuf_concat(s, *p == '\n' ? "\\n" : *p == '"' ? "\\\"" : "\\\\");
+        start = p + 1;
+    }
+    sbuf_nconcat(s, start, p - start);
+    sbuf_concat(s, "\"");
+}
+
+static void snapshot_window(struct sbuf *s, rp_window_elem *elem, int mapped)
+{
+    rp_window *win = elem->win;
+    rp_frame *frame;
+
+    /* This is a round trip the first time only, then it's cached. */
+    if (!win->pid_cached)
+        update_window_pid(win);
+
+    frame = mapped ? find_windows_frame(win) : NULL;
+
+    sbuf_printf_concat(s, " (window :id %ld :number %d :internal-number %d "
+                       ":screen %d :vscreen %d :frame %d :mapped %d "
+                       ":x %d :y %d :width %d :height %d :border %d "
+                       ":state %d :transient %d :transient-for %ld "
+                       ":floated %d :full-screen %d :gravity %d "
+                       ":last-access %d :pid %lu :pid-local %d :name ",
+                       win->w, elem->number, win->number,
+                       win->vscreen->screen->number, win->vscreen->number,
+                       frame ? frame->number : -1, mapped, win->x, win->y,
+                       win->width, win->height, win->border, win->state,
+                       win->transient, win->transient_for, win->floated,
+                       win->full_screen, win->gravity, win->last_access,
+                       win->pid_cached ? win->pid : 0UL,
+                       win->pid_cached ? win->pid_local : 0);
+    snapshot_string(s, window_name(win));
+    sbuf_concat(s, " :title ");
+    snapshot_string(s, win->wm_name);
+    sbuf_concat(s, " :res-name ");
+    snapshot_string(s, win->res_name);
+    sbuf_concat(s, " :res-class ");
+    snapshot_string(s, win->res_class);
+    sbuf_concat(s, ")\n");
+}
+
+static void snapshot_build(struct sbuf *s)
+{
+    rp_screen *screen;
+    rp_vscreen *v;
+    rp_frame *frame;
+    rp_window_elem *elem;
+    rp_window *win;
+
+    sbuf_printf(s, "(snapshot :generation %lu\n", generation);
+
+    list_for_each_entry(screen, &rp_screens, node) {
+        sbuf_printf_concat(s, " (screen :number %d :name ", screen->number);
+        snapshot_string(s, rp_have_xrandr ? screen->xrandr.name : NULL);
+        sbuf_printf_concat(s, " :x %d :y %d :width %d :height %d "
+                           ":current-vscreen %d)\n", screen->left,
+                           screen->top, screen->width, screen->height,
+                           screen->current_vscreen->number);
+
+        list_for_each_entry(v, &screen->vscreens, node) {
+            sbuf_printf_concat(s, " (vscreen :screen %d :number %d :name ",
+                               screen->number, v->number);
+            snapshot_string(s, v->name);
+            sbuf_printf_concat(s, " :current-frame %d :last-access %d)\n",
+                               v->current_frame, v->last_access);
+
+            /* The same fields frame_dump gives. */
+            list_for_each_entry(frame, &v->frames, node) {
+                win = find_window_number(frame->win_number);
+                sbuf_printf_concat(s, " (frame :screen %d :vscreen %d "
+                                   ":number %d :x %d :y %d :width %d "
+                                   ":height %d :screenw %d :screenh %d "
+                                   ":window %ld :last-access %d "
+                                   ":dedicated %d)\n", screen->number,
+                                   v->number, frame->number, frame->x,
+                                   frame->y, frame->width, frame->height,
+                                   screen->width, screen->height,
+                                   win ? win->w : 0, frame->last_access,
+                                   frame->dedicated);
+            }
+
+            list_for_each_entry(elem, &v->mapped_windows, node)
+                snapshot_window(s, elem, 1);
+            list_for_each_entry(elem, &v->unmapped_windows, node)
+                snapshot_window(s, elem, 0);
+        }
+    }
+
+    frame = current_frame(rp_current_vscreen);
+    win = current_window();
+    sbuf_printf_concat(s, " (focus :screen %d :vscreen %d :frame %d "
+                       ":window %ld))", rp_current_screen->number,
+                       rp_current_vscreen->number,
+                       frame ? frame->number : -1, win ? win->w : 0);
+}
+
+/* Return the snapshot in a string the caller frees. */
+char *snapshot_dump(void)
+{
+    char *copy;
+
+    /*
+     * Keep the buffer between snapshots, it's already about the right size
+     * for the next one.
+     */
+    if (cached == NULL)
+        cached = sbuf_new(4096);
+
+    if (cached_generation != generation || cached->len == 0) {
+        sbuf_clear(cached);
+        snapshot_build(cached);
+        cached_generation = generation;
+    }
+
+    copy = xmalloc(cached->len + 1);
+    memcpy(copy, sbuf_get(cached), cached->len + 1);
+    return copy;
+}
+
+void free_snapshot(void)
+{
+    sbuf_free(cached);
+    cached = NULL;
+}
@@ -19,6 +19,8 @@
 
 #include <unistd.h>
 #include <err.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 
 #include "poison.h"
@@ -60,8 +62,10 @@ void cleanup_frame(rp_frame *frame)
 
 rp_window *set_frames_window(rp_frame *frame, rp_window *win)
 {
+    rp_window *last;
     int last_win;
 
+    snapshot_touch();
     last_win = frame->win_number;
     if (win) {
         frame->win_number = win->number;
@@ -73,11 +77,18 @@ rp_window *set_frames_window(rp_frame *frame, rp_window *win)
          * to another.
          */
         win->vscreen = frame->vscreen;
+        win->shown_in = frame;
+        win->shown_generation = frame->vscreen->frames_generation;
     } else {
         frame->win_number = EMPTY;
     }
 
-    return find_window_number(last_win);
+    /* The last window may still be in another frame, so look again. */
+    last = find_window_number(last_win);
+    if (last && last != win)
+        last->shown_generation = 0;
+
+    return last;
 }
 
 void maximize_all_windows_in_frame(rp_frame *frame)
@@ -101,6 +112,7 @@ void maximize_frame(rp_frame *frame)
 
     frame->width = screen_width(v->screen);
     frame->height = screen_height(v->screen);
+    frames_changed(v);
 }
 
 /* Create a full screen frame */
@@ -141,7 +153,11 @@ rp_frame *find_last_frame(rp_vscreen *v)
     return last;
 }
 
-/* Return the frame that contains the window. */
+/*
+ * Return the frame that contains the window. The answer is kept in the
+ * window, set_frames_window() keeps it up to date and frame_windows_changed()
+ * throws all of them away for a vscreen.
+ */
 rp_frame *find_windows_frame(rp_window *win)
 {
     rp_vscreen *v;
@@ -149,12 +165,21 @@ rp_frame *find_windows_frame(rp_window *win)
 
     v = win->vscreen;
 
+    if (win->shown_generation == v->frames_generation
+        && (win->shown_in == NULL
+            || win->shown_in->win_number == win->number))
+        return win->shown_in;
+
+    win->shown_in = NULL;
+    win->shown_generation = v->frames_generation;
     list_for_each_entry(cur, &v->frames, node) {
-        if (cur->win_number == win->number)
-            return cur;
+        if (cur->win_number == win->number) {
+            win->shown_in = cur;
+            break;
+        }
     }
 
-    return NULL;
+    return win->shown_in;
 }
 
 int num_frames(rp_vscreen *v)
@@ -204,26 +229,593 @@ static int window_fits_in_frame(rp_window *win, rp_frame *frame)
 rp_window *find_window_for_frame(rp_frame *frame)
 {
     rp_vscreen *v = frame->vscreen;
-    int last_access = 0;
-    rp_window_elem *most_recent = NULL;
     rp_window_elem *cur;
+    rp_window *current = current_window();
 
-    list_for_each_entry(cur, &v->mapped_windows, node) {
-        if (cur->win != current_window()
+    list_for_each_entry(cur, &v->mru_windows, mru) {
+        if (cur->win != current
             && cur->win->sticky_frame != frame->number
             && !find_windows_frame(cur->win)
-            && cur->win->last_access >= last_access
             && window_fits_in_frame(cur->win, frame)
-            && cur->win->frame_number == EMPTY) {
-            most_recent = cur;
-            last_access = cur->win->last_access;
-        }
+            && cur->win->frame_number == EMPTY)
+            return cur->win;
+    }
+
+    return NULL;
+}
+
+/*
+ * The frame index keeps the frames of a vscreen sorted by where each of their
+ * sides is, and then by number. It is rebuilt the first time it's needed
+ * after frames_changed(), and frame_side_moved() keeps it in order as sides
+ * are dragged around so resizing doesn't throw it away at every step.
+ */
+
+/* The side frame_index_cmp sorts by. */
+static int index_side;
+
+static int frame_index_cmp(const void *a, const void *b)
+{
+    rp_frame *f1 = *(rp_frame **) a;
+    rp_frame *f2 = *(rp_frame **) b;
+    int p1 = frame_side(f1, index_side);
+    int p2 = frame_side(f2, index_side);
+
+    if (p1 != p2)
+        return p1 < p2 ? -1 : 1;
+    return f1->number - f2->number;
+}
+
+/* Call this when frames of v were added, removed or moved around. */
+void frames_changed(rp_vscreen *v)
+{
+    v->frame_index_valid = 0;
+    snapshot_touch();
+}
+
+/*
+ * Call this when frames of v were freed or replaced. The generations are
+ * never reused, so a window can't mistake another vscreen's for its own.
+ */
+void frame_windows_changed(rp_vscreen *v)
+{
+    static unsigned long generation;
+
+    v->frames_generation = ++generation;
+}
+
+static void frame_index_build(rp_vscreen *v)
+{
+    rp_frame *cur;
+    int n = num_frames(v), side, i;
+
+    if (n > v->frame_index_size) {
+        v->frame_index_size = n * 2;
+        for (side = 0; side < SIDES; side++)
+            v->frame_index[side] =
+                xrealloc(v->frame_index[side],
+                         v->frame_index_size * sizeof(rp_frame *));
     }
 
-    if (most_recent)
-        return most_recent->win;
+    for (side = 0; side < SIDES; side++) {
+        i = 0;
+        list_for_each_entry(cur, &v->frames, node)
+            v->frame_index[side][i++] = cur;
+
+        index_side = side;
+        qsort(v->frame_index[side], n, sizeof(rp_frame *), frame_index_cmp);
+    }
+
+    v->frame_index_len = n;
+    v->frame_index_valid = 1;
+}
+
+/*
+ * Return the first slot in the index for side that holds a frame at or after
+ * pos and number, taking moved to still be at old.
+ */
+static int
+frame_index_search(rp_vscreen *v, int side, int pos, int number,
+                   rp_frame *moved, int old)
+{
+    rp_frame **a = v->frame_index[side];
+    int lo = 0, hi = v->frame_index_len, mid, p;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        p = a[mid] == moved ? old : frame_side(a[mid], side);
+
+        if (p < pos || (p == pos && a[mid]->number < number))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Point *found at the frames in v that have side at pos and return how many
+ * there are. They stay put until the frames change.
+ */
+static int frames_at(rp_vscreen *v, int side, int pos, rp_frame ***found)
+{
+    int first, last;
+
+    if (!v->frame_index_valid)
+        frame_index_build(v);
+
+    first = frame_index_search(v, side, pos, INT_MIN, NULL, 0);
+    last = frame_index_search(v, side, pos + 1, INT_MIN, NULL, 0);
+    *found = v->frame_index[side] + first;
+
+    return last - first;
+}
+
+/* Put frame back in order after its side moved away from old. */
+void frame_side_moved(rp_frame *frame, int side, int old)
+{
+    rp_vscreen *v = frame->vscreen;
+    rp_frame **a = v->frame_index[side];
+    int from, to;
+
+    snapshot_touch();
+
+    if (!v->frame_index_valid)
+        return;
+
+    from = frame_index_search(v, side, old, frame->number, frame, old);
+
+    /* A copy of a frame, it's not in there. Don't trust the index. */
+    if (from == v->frame_index_len || a[from] != frame) {
+        frames_changed(v);
+        return;
+    }
+
+    v->frame_index_len--;
+    memmove(a + from, a + from + 1,
+            (v->frame_index_len - from) * sizeof(rp_frame *));
+
+    to = frame_index_search(v, side, frame_side(frame, side), frame->number,
+                            NULL, 0);
+    memmove(a + to + 1, a + to,
+            (v->frame_index_len - to) * sizeof(rp_frame *));
+    a[to] = frame;
+    v->frame_index_len++;
+}
+
+/*
+ * The split tree remembers how the frames of a vscreen were made. Leaves are
+ * frames, the other nodes cut their rectangle in two, giving ratio of it to
+ * the first child, which is the left or top one. Removing and resizing frames
+ * are done on the tree, and only the part of it that changed is laid out
+ * again.
+ *
+ * When the frames are replaced from elsewhere, as frestore and undo do, the
+ * tree is forgotten and worked out again from the frames the next time it's
+ * needed. Layouts that can't be cut in two all the way down have no tree and
+ * get the old geometric treatment.
+ */
+
+static rp_split *split_leaf(rp_frame *frame)
+{
+    rp_split *node;
+
+    node = xmalloc(sizeof(rp_split));
+    node->parent = node->child[0] = node->child[1] = NULL;
+    node->frame = frame;
+    node->way = VERTICALLY;
+    node->ratio = 1;
+    node->x = frame->x;
+    node->y = frame->y;
+    node->width = frame->width;
+    node->height = frame->height;
+    frame->split = node;
+
+    return node;
+}
+
+static void split_free(rp_split *node)
+{
+    if (node == NULL)
+        return;
+
+    if (node->frame)
+        node->frame->split = NULL;
+    split_free(node->child[0]);
+    split_free(node->child[1]);
+    free(node);
+}
+
+/* Forget the split tree of v, the frames changed behind its back. */
+void split_tree_forget(rp_vscreen *v)
+{
+    split_free(v->split_tree);
+    v->split_tree = NULL;
+    v->split_tree_stale = 1;
+}
+
+/*
+ * Work out a tree for the n frames in frames, which must exactly tile the
+ * rectangle. Return NULL if they don't, or can't be cut in two.
+ */
+static rp_split *
+split_build(rp_frame **frames, int n, int x, int y, int width, int height)
+{
+    rp_split *node, *first, *second;
+    rp_frame *tmp;
+    int i, j, k, cut = 0, way;
+
+    if (n == 0)
+        return NULL;
+
+    if (n == 1) {
+        if (frames[0]->x != x || frames[0]->y != y
+            || frames[0]->width != width || frames[0]->height != height)
+            return NULL;
+        return split_leaf(frames[0]);
+    }
+
+    /* Look for a line across the rectangle that no frame straddles. */
+    for (way = VERTICALLY; way <= HORIZONTALLY; way++) {
+        for (i = 0; i < n; i++) {
+            if (way == VERTICALLY) {
+                cut = frame_right(frames[i]);
+                if (cut >= x + width)
+                    continue;
+            } else {
+                cut = frame_bottom(frames[i]);
+                if (cut >= y + height)
+                    continue;
+            }
+
+            for (j = 0; j < n; j++) {
+                if (way == VERTICALLY && frame_left(frames[j]) < cut
+                    && frame_right(frames[j]) > cut)
+                    break;
+                if (way == HORIZONTALLY && frame_top(frames[j]) < cut
+                    && frame_bottom(frames[j]) > cut)
+                    break;
+            }
+            if (j == n)
+                goto found;
+        }
+    }
 
     return NULL;
+
+  found:
+    /* Put the frames before the cut first. */
+    for (i = k = 0; i < n; i++) {
+        if ((way == VERTICALLY && frame_right(frames[i]) <= cut)
+            || (way == HORIZONTALLY && frame_bottom(frames[i]) <= cut)) {
+            tmp = frames[k];
+            frames[k++] = frames[i];
+            frames[i] = tmp;
+        }
+    }
+
+    if (way == VERTICALLY) {
+        first = split_build(frames, k, x, y, cut - x, height);
+        second = first ? split_build(frames + k, n - k, cut, y,
+                                     x + width - cut, height) : NULL;
+    } else {
+        first = split_build(frames, k, x, y, width, cut - y);
+        second = first ? split_build(frames + k, n - k, x, cut, width,
+                                     y + height - cut) : NULL;
+    }
+
+    if (second == NULL) {
+        split_free(first);
+        return NULL;
+    }
+
+    node = xmalloc(sizeof(rp_split));
+    node->parent = NULL;
+    node->child[0] = first;
+    node->child[1] = second;
+    node->frame = NULL;
+    node->way = way;
+    if (way == VERTICALLY)
+        node->ratio = (double) (cut - x) / width;
+    else
+        node->ratio = (double) (cut - y) / height;
+    node->x = x;
+    node->y = y;
+    node->width = width;
+    node->height = height;
+    first->parent = second->parent = node;
+
+    return node;
+}
+
+/* Return the split tree of v, or NULL if its frames don't make one. */
+static rp_split *split_tree(rp_vscreen *v)
+{
+    rp_frame **frames, *cur;
+    int n, i = 0, left = INT_MAX, top = INT_MAX, right = INT_MIN,
+        bottom = INT_MIN;
+
+    if (v->split_tree || !v->split_tree_stale)
+        return v->split_tree;
+
+    v->split_tree_stale = 0;
+
+    n = num_frames(v);
+    frames = xmalloc(n * sizeof(rp_frame *));
+    list_for_each_entry(cur, &v->frames, node) {
+        frames[i++] = cur;
+        if (frame_left(cur) < left)
+            left = frame_left(cur);
+        if (frame_top(cur) < top)
+            top = frame_top(cur);
+        if (frame_right(cur) > right)
+            right = frame_right(cur);
+        if (frame_bottom(cur) > bottom)
+            bottom = frame_bottom(cur);
+    }
+
+    v->split_tree = split_build(frames, n, left, top, right - left,
+                                bottom - top);
+    free(frames);
+
+    PRINT_DEBUG(("%s split tree for vscreen %d\n",
+                 v->split_tree ? "Built" : "No", v->number));
+
+    return v->split_tree;
+}
+
+/* How far node reaches along the axis that way cuts. */
+static int split_extent(rp_split *node, int way)
+{
+    return way == VERTICALLY ? node->width : node->height;
+}
+
+/* The way of the cuts that side runs along. */
+static int side_way(int side)
+{
+    return (side == SIDE_LEFT || side == SIDE_RIGHT) ? VERTICALLY :
+        HORIZONTALLY;
+}
+
+/* Which child of a node cut along side touches that side of it. */
+static int side_child(int side)
+{
+    return (side == SIDE_RIGHT || side == SIDE_BOTTOM) ? 1 : 0;
+}
+
+static int opposite_side(int side)
+{
+    return SIDES - 1 - side;
+}
+
+/* Lay node and everything under it out in the rectangle. */
+static void
+split_layout(rp_split *node, int x, int y, int width, int height)
+{
+    rp_frame *frame = node->frame;
+    int first;
+
+    node->x = x;
+    node->y = y;
+    node->width = width;
+    node->height = height;
+
+    if (frame) {
+        if (frame->x == x && frame->y == y && frame->width == width
+            && frame->height == height)
+            return;
+
+        frame->x = x;
+        frame->y = y;
+        frame->width = width;
+        frame->height = height;
+        frames_changed(frame->vscreen);
+        maximize_all_windows_in_frame(frame);
+        return;
+    }
+
+    if (node->way == VERTICALLY) {
+        first = lround(node->ratio * width);
+        split_layout(node->child[0], x, y, first, height);
+        split_layout(node->child[1], x + first, y, width - first, height);
+    } else {
+        first = lround(node->ratio * height);
+        split_layout(node->child[0], x, y, width, first);
+        split_layout(node->child[1], x, y + first, width, height - first);
+    }
+}
+
+/*
+ * How many pixels node can give up on side, taking them only from the frames
+ * along that side.
+ */
+static int split_slack(rp_split *node, int side)
+{
+    int way = side_way(side), first, second;
+
+    if (node->frame)
+        return split_extent(node, way) - 1 -
+            (defaults.window_border_width * 2) - (defaults.gap * 2);
+
+    if (node->way == way)
+        return split_slack(node->child[side_child(side)], side);
+
+    first = split_slack(node->child[0], side);
+    second = split_slack(node->child[1], side);
+
+    return first < second ? first : second;
+}
+
+/*
+ * Move side of node out by delta pixels. Only the frames along that side
+ * change size, the cuts further in stay where they are. Nothing is laid out,
+ * that's for the caller to do once it's done moving things.
+ */
+static void split_move_edge(rp_split *node, int side, int delta)
+{
+    int way = side_way(side), first;
+
+    if (node->frame == NULL && node->way == way) {
+        first = split_extent(node->child[0], way);
+        if (side_child(side) == 0)
+            first += delta;
+        node->ratio = (double) first / (split_extent(node, way) + delta);
+        split_move_edge(node->child[side_child(side)], side, delta);
+    } else if (node->frame == NULL) {
+        split_move_edge(node->child[0], side, delta);
+        split_move_edge(node->child[1], side, delta);
+    }
+
+    switch (side) {
+    case SIDE_LEFT:
+        node->x -= delta;
+        node->width += delta;
+        break;
+    case SIDE_RIGHT:
+        node->width += delta;
+        break;
+    case SIDE_TOP:
+        node->y -= delta;
+        node->height += delta;
+        break;
+    default:
+        node->height += delta;
+    }
+}
+
+/* Cut the leaf for frame in two, new_frame getting the right or bottom. */
+static void split_insert(rp_frame *frame, rp_frame *new_frame, int way)
+{
+    rp_split *leaf = frame->split, *node;
+
+    node = xmalloc(sizeof(rp_split));
+    *node = *leaf;
+    node->frame = NULL;
+    node->way = way;
+    node->ratio = way == VERTICALLY ?
+        (double) frame->width / node->width :
+        (double) frame->height / node->height;
+
+    if (node->parent == NULL)
+        frame->vscreen->split_tree = node;
+    else if (node->parent->child[0] == leaf)
+        node->parent->child[0] = node;
+    else
+        node->parent->child[1] = node;
+
+    node->child[0] = leaf;
+    node->child[1] = split_leaf(new_frame);
+    leaf->parent = node->child[1]->parent = node;
+    leaf->x = frame->x;
+    leaf->y = frame->y;
+    leaf->width = frame->width;
+    leaf->height = frame->height;
+}
+
+/* Bring the windows in the frames under node to the top. */
+static void split_raise(rp_split *node)
+{
+    if (node->frame == NULL) {
+        split_raise(node->child[0]);
+        split_raise(node->child[1]);
+    } else if (node->frame->win_number != EMPTY) {
+        XRaiseWindow(dpy, find_window_number(node->frame->win_number)->w);
+    }
+}
+
+/*
+ * Take frame out of the tree, its sibling growing into the space it leaves.
+ * frame is left for the caller to free.
+ */
+static void split_remove(rp_frame *frame)
+{
+    rp_split *leaf = frame->split, *parent = leaf->parent, *sibling;
+    int first = parent->child[1] == leaf;
+
+    sibling = parent->child[first ? 0 : 1];
+
+    split_move_edge(sibling, parent->way == VERTICALLY ?
+                    (first ? SIDE_RIGHT : SIDE_LEFT) :
+                    (first ? SIDE_BOTTOM : SIDE_TOP),
+                    split_extent(leaf, parent->way));
+
+    sibling->parent = parent->parent;
+    if (parent->parent == NULL)
+        frame->vscreen->split_tree = sibling;
+    else if (parent->parent->child[0] == parent)
+        parent->parent->child[0] = sibling;
+    else
+        parent->parent->child[1] = sibling;
+
+    split_layout(sibling, parent->x, parent->y, parent->width,
+                 parent->height);
+
+    frame->split = NULL;
+    free(leaf);
+    free(parent);
+
+    split_raise(sibling);
+}
+
+/*
+ * Move side of frame out by diff pixels, moving the whole cut it's on.
+ * Return -1 if that can't be done.
+ */
+static int split_resize(rp_frame *frame, int side, int diff)
+{
+    rp_split *node, *cut, *other;
+
+    for (node = frame->split; (cut = node->parent); node = cut) {
+        if (cut->way == side_way(side)
+            && cut->child[side_child(opposite_side(side))] == node)
+            break;
+    }
+    if (cut == NULL)
+        return -1;
+
+    other = cut->child[side_child(side)];
+
+    if ((diff > 0 && split_slack(other, opposite_side(side)) < diff)
+        || (diff < 0 && split_slack(node, side) < -diff))
+        return -1;
+
+    split_move_edge(node, side, diff);
+    split_move_edge(other, opposite_side(side), -diff);
+    cut->ratio = (double) split_extent(cut->child[0], cut->way) /
+        split_extent(cut, cut->way);
+
+    split_layout(cut, cut->x, cut->y, cut->width, cut->height);
+
+    return 0;
+}
+
+/*
+ * Fit the frames of v to its screen after the screen changed. With rescale
+ * the splits keep their proportions, otherwise only the frames along the
+ * sides of the screen move. Return 0 if v has no split tree to do it with.
+ */
+int split_tree_fit(rp_vscreen *v, int rescale)
+{
+    rp_split *root = split_tree(v);
+    rp_screen *s = v->screen;
+
+    if (root == NULL)
+        return 0;
+
+    if (!rescale) {
+        split_move_edge(root, SIDE_LEFT, root->x - screen_left(s));
+        split_move_edge(root, SIDE_TOP, root->y - screen_top(s));
+        split_move_edge(root, SIDE_RIGHT,
+                        screen_right(s) - (root->x + root->width));
+        split_move_edge(root, SIDE_BOTTOM,
+                        screen_bottom(s) - (root->y + root->height));
+    }
+
+    split_layout(root, screen_left(s), screen_top(s), screen_width(s),
+                 screen_height(s));
+
+    return 1;
 }
 
 /*
@@ -235,8 +827,10 @@ static void split_frame(rp_frame *frame, int way, int pixels)
     rp_vscreen *v;
     rp_window *win;
     rp_frame *new_frame;
+    rp_split *tree;
 
     v = frame->vscreen;
+    tree = split_tree(v);
 
     /* Make our new frame. */
     new_frame = frame_new(v);
@@ -261,6 +855,12 @@ static void split_frame(rp_frame *frame, int way, int pixels)
 
         frame->width = pixels;
     }
+    frames_changed(v);
+
+    if (tree)
+        split_insert(frame, new_frame, way);
+    else
+        split_tree_forget(v);
 
     win = find_window_for_frame(new_frame);
     if (win) {
@@ -308,6 +908,8 @@ void remove_all_splits(void)
     rp_frame *frame;
     rp_window *win;
 
+    split_tree_forget(v);
+
     /* Hide all the windows not in the current frame. */
     list_for_each_entry(win, &rp_mapped_window, node) {
         if (win->frame_number != v->current_frame && win->vscreen == v)
@@ -355,66 +957,80 @@ void resize_shrink_to_window(rp_frame *frame)
  * functions passed to it. Returns -1 if the resize failed, 0 for success.
  */
 static int
-resize_frame(rp_frame *frame, rp_frame *pusher, int diff,
-             int (*c1)(rp_frame *), int(c2)(rp_frame *),
-             int(*c3)(rp_frame *), int(c4)(rp_frame *),
+resize_frame(rp_frame *frame, rp_frame *pusher, int diff, int side,
+             int(c2)(rp_frame *), int(*c3)(rp_frame *), int(c4)(rp_frame *),
              void(*resize1)(rp_frame *, int),
              void(*resize2)(rp_frame *, int),
              int(*resize3)(rp_frame *, rp_frame *, int))
 {
     rp_vscreen *v = frame->vscreen;
-    rp_frame *cur;
+    rp_frame *cur, **found, **touching;
+    int edge = (*c3) (frame);
+    int i, n, ret = 0;
 
     /*
-     * Loop through the frames and determine which ones are affected by
-     * resizing frame.
+     * The frames with their side touching frame along the axis that is
+     * being moved are the ones affected by the resize. Take a copy, the
+     * index changes under us as they are resized.
      */
-    list_for_each_entry(cur, &v->frames, node) {
+    n = frames_at(v, side, edge, &found);
+    touching = xmalloc((n + 1) * sizeof(rp_frame *));
+    memcpy(touching, found, n * sizeof(rp_frame *));
+
+    for (i = 0; i < n; i++) {
+        cur = touching[i];
         if (cur == frame || cur == pusher)
             continue;
+
+        /* It was already moved along with an earlier one. */
+        if (frame_side(cur, side) != edge)
+            continue;
+
+        /* If the frame can't get any smaller, then fail. */
+        if (diff > 0 && abs((*c3) (cur) - frame_side(cur, side)) - diff <=
+            (defaults.window_border_width * 2) + (defaults.gap * 2)) {
+            ret = -1;
+            break;
+        }
+
         /*
-         * If cur is touching frame along the axis that is being moved
-         * then this frame is affected by the resize.
+         * Test for this circumstance:
+         * --+ | |+-+ |f||c| | |+-+ --+
+         *
+         * In this case, resizing cur will not affect any other
+         * frames, so just do the resize.
          */
-        if ((*c1) (cur) == (*c3) (frame)) {
-            /* If the frame can't get any smaller, then fail. */
-            if (diff > 0 && abs((*c3) (cur) - (*c1) (cur)) - diff <=
-                (defaults.window_border_width * 2) + (defaults.gap * 2))
-                return -1;
-
-            /*
-             * Test for this circumstance:
-             * --+ | |+-+ |f||c| | |+-+ --+
-             *
-             * In this case, resizing cur will not affect any other
-             * frames, so just do the resize.
-             */
-            if (((*c2) (cur) >= (*c2) (frame))
-                && (*c4) (cur) <= (*c4) (frame)) {
-                (*resize2) (cur, -diff);
-                maximize_all_windows_in_frame(cur);
-            }
-            /*
-             * Otherwise, cur's corners are either strictly outside
-             * frame's corners, or one of them is inside and the
-             * other isn't. In either of these cases, resizing cur
-             * will affect other adjacent frames, so find them and
-             * resize them first (recursive step) and then resize
-             * cur.
-             */
-            else if (((*c2) (cur) < (*c2) (frame)
-                      && (*c4) (cur) > (*c4) (frame))
-                     || ((*c2) (cur) >= (*c2) (frame)
-                         && (*c2) (cur) < (*c4) (frame))
-                     || ((*c4) (cur) > (*c2) (frame)
-                         && (*c4) (cur) <= (*c4) (frame))) {
-                /* Attempt to resize cur. */
-                if (resize3(cur, frame, -diff) == -1)
-                    return -1;
+        if (((*c2) (cur) >= (*c2) (frame))
+            && (*c4) (cur) <= (*c4) (frame)) {
+            (*resize2) (cur, -diff);
+            maximize_all_windows_in_frame(cur);
+        }
+        /*
+         * Otherwise, cur's corners are either strictly outside
+         * frame's corners, or one of them is inside and the
+         * other isn't. In either of these cases, resizing cur
+         * will affect other adjacent frames, so find them and
+         * resize them first (recursive step) and then resize
+         * cur.
+         */
+        else if (((*c2) (cur) < (*c2) (frame)
+                  && (*c4) (cur) > (*c4) (frame))
+                 || ((*c2) (cur) >= (*c2) (frame)
+                     && (*c2) (cur) < (*c4) (frame))
+                 || ((*c4) (cur) > (*c2) (frame)
+                     && (*c4) (cur) <= (*c4) (frame))) {
+            /* Attempt to resize cur. */
+            if (resize3(cur, frame, -diff) == -1) {
+                ret = -1;
+                break;
             }
         }
     }
 
+    free(touching);
+    if (ret == -1)
+        return -1;
+
     /* Finally, resize the frame and the windows inside. */
     (*resize1) (frame, diff);
     maximize_all_windows_in_frame(frame);
@@ -434,7 +1050,7 @@ static int resize_frame_right(rp_frame * frame, rp_frame * pusher,
 static int resize_frame_right(rp_frame *frame, rp_frame *pusher, int diff)
 {
     return resize_frame(frame, pusher, diff,
-                        frame_left, frame_top, frame_right, frame_bottom,
+                        SIDE_LEFT, frame_top, frame_right, frame_bottom,
                         frame_resize_right, frame_resize_left,
                         resize_frame_left);
 }
@@ -443,7 +1059,7 @@ static int resize_frame_right(rp_frame *frame, rp_frame *pusher, int diff)
 static int resize_frame_left(rp_frame *frame, rp_frame *pusher, int diff)
 {
     return resize_frame(frame, pusher, diff,
-                        frame_right, frame_top, frame_left, frame_bottom,
+                        SIDE_RIGHT, frame_top, frame_left, frame_bottom,
                         frame_resize_left, frame_resize_right,
                         resize_frame_right);
 }
@@ -452,7 +1068,7 @@ static int resize_frame_left(rp_frame *frame, rp_frame *pusher, int diff)
 static int resize_frame_top(rp_frame *frame, rp_frame *pusher, int diff)
 {
     return resize_frame(frame, pusher, diff,
-                        frame_bottom, frame_left, frame_top, frame_right,
+                        SIDE_BOTTOM, frame_left, frame_top, frame_right,
                         frame_resize_up, frame_resize_down,
                         resize_frame_bottom);
 }
@@ -461,7 +1077,7 @@ static int resize_frame_top(rp_frame *frame, rp_frame *pusher, int diff)
 static int resize_frame_bottom(rp_frame *frame, rp_frame *pusher, int diff)
 {
     return resize_frame(frame, pusher, diff,
-                        frame_top, frame_left, frame_bottom, frame_right,
+                        SIDE_TOP, frame_left, frame_bottom, frame_right,
                         frame_resize_down, frame_resize_up,
                         resize_frame_top);
 }
@@ -475,6 +1091,7 @@ void resize_frame_horizontally(rp_frame *frame, int diff)
     int (*resize_fn)(rp_frame *, rp_frame *, int);
     struct list_head *l;
     rp_vscreen *v = frame->vscreen;
+    int side;
 
     if (num_frames(v) < 2 || diff == 0)
         return;
@@ -486,12 +1103,19 @@ void resize_frame_horizontally(rp_frame *frame, int diff)
     /* Find out which resize function to use. */
     if (frame_right(frame) < screen_right(v->screen)) {
         resize_fn = resize_frame_right;
+        side = SIDE_RIGHT;
     } else if (frame_left(frame) > screen_left(v->screen)) {
         resize_fn = resize_frame_left;
+        side = SIDE_LEFT;
     } else {
         return;
     }
 
+    if (split_tree(v)) {
+        split_resize(frame, side, diff);
+        return;
+    }
+
     /*
      * Copy the frameset. If the resize fails, then we restore the original
      * one.
@@ -502,6 +1126,7 @@ void resize_frame_horizontally(rp_frame *frame, int diff)
         vscreen_restore_frameset(v, l);
     } else {
         frameset_free(l);
+        split_tree_forget(v);
     }
 
     /* It's our responsibility to free this. */
@@ -517,6 +1142,7 @@ void resize_frame_vertically(rp_frame *frame, int diff)
     int (*resize_fn)(rp_frame *, rp_frame *, int);
     struct list_head *l;
     rp_vscreen *v = frame->vscreen;
+    int side;
 
     if (num_frames(v) < 2 || diff == 0)
         return;
@@ -528,12 +1154,19 @@ void resize_frame_vertically(rp_frame *frame, int diff)
     /* Find out which resize function to use. */
     if (frame_bottom(frame) < screen_bottom(v->screen)) {
         resize_fn = resize_frame_bottom;
+        side = SIDE_BOTTOM;
     } else if (frame_top(frame) > screen_top(v->screen)) {
         resize_fn = resize_frame_top;
+        side = SIDE_TOP;
     } else {
         return;
     }
 
+    if (split_tree(v)) {
+        split_resize(frame, side, diff);
+        return;
+    }
+
     /*
      * Copy the frameset. If the resize fails, then we restore the original
      * one.
@@ -544,6 +1177,7 @@ void resize_frame_vertically(rp_frame *frame, int diff)
         vscreen_restore_frameset(v, l);
     } else {
         frameset_free(l);
+        split_tree_forget(v);
     }
 
     /* It's our responsibility to free this. */
@@ -620,7 +1254,7 @@ static int frame_overlaps(rp_frame *frame)
 void remove_frame(rp_frame *frame)
 {
     rp_vscreen *v;
-    int area;
+    int area, covered, cur_area, tree = 0;
     rp_frame *cur;
     rp_window *win;
 
@@ -629,10 +1263,23 @@ void remove_frame(rp_frame *frame)
 
     v = frame->vscreen;
 
+    /* With a split tree, the frame's sibling takes over its space. */
+    if (split_tree(v) && frame->split->parent)
+        tree = 1;
+    else
+        split_tree_forget(v);
+
     area = total_frame_area(v);
     PRINT_DEBUG(("Total Area: %d\n", area));
 
     list_del(&frame->node);
+
+    /*
+     * What the other frames cover. It's kept up to date as they grow, so
+     * trying a frame doesn't need to add them all up again.
+     */
+    covered = area - frame->width * frame->height;
+
     win = find_window_number(frame->win_number);
     hide_window(win);
     hide_others(win);
@@ -642,12 +1289,19 @@ void remove_frame(rp_frame *frame)
             win->sticky_frame = EMPTY;
     }
 
+    if (tree) {
+        split_remove(frame);
+        frame_free(v, frame);
+        return;
+    }
+
     list_for_each_entry(cur, &v->frames, node) {
         rp_frame tmp_frame;
         int fits = 0;
 
         /* Backup the frame */
         memcpy(&tmp_frame, cur, sizeof(rp_frame));
+        cur_area = cur->width * cur->height;
 
         if (frame_is_below(frame, cur)
             || frame_is_above(frame, cur)) {
@@ -657,7 +1311,8 @@ void remove_frame(rp_frame *frame)
         }
         PRINT_DEBUG(("Attempting vertical Frame y=%d height=%d\n",
                      cur->y, cur->height));
-        PRINT_DEBUG(("New Total Area: %d\n", total_frame_area(v)));
+        PRINT_DEBUG(("New Total Area: %d\n",
+                     covered - cur_area + cur->width * cur->height));
 
         /*
          * If the area is bigger than before, the frame takes up too
@@ -668,8 +1323,8 @@ void remove_frame(rp_frame *frame)
          * have taken up the right amount of space, overlaps with the
          * deleted frame but obviously didn't fit.
          */
-        if (total_frame_area(v) > area || !frames_overlap(cur, frame) ||
-            frame_overlaps(cur)) {
+        if (covered - cur_area + cur->width * cur->height > area ||
+            !frames_overlap(cur, frame) || frame_overlaps(cur)) {
             PRINT_DEBUG(("Didn't fit vertically\n"));
 
             /* Restore the current window's frame */
@@ -679,6 +1334,8 @@ void remove_frame(rp_frame *frame)
 
             /* update the frame backup */
             memcpy(&tmp_frame, cur, sizeof(rp_frame));
+            covered += cur->width * cur->height - cur_area;
+            cur_area = cur->width * cur->height;
             fits = 1;
         }
 
@@ -690,17 +1347,19 @@ void remove_frame(rp_frame *frame)
         }
         PRINT_DEBUG(("Attempting horizontal Frame x=%d width=%d\n",
                      cur->x, cur->width));
-        PRINT_DEBUG(("New Total Area: %d\n", total_frame_area(v)));
+        PRINT_DEBUG(("New Total Area: %d\n",
+                     covered - cur_area + cur->width * cur->height));
 
         /* Same test as the vertical test, above. */
-        if (total_frame_area(v) > area || !frames_overlap(cur, frame) ||
-            frame_overlaps(cur)) {
+        if (covered - cur_area + cur->width * cur->height > area ||
+            !frames_overlap(cur, frame) || frame_overlaps(cur)) {
             PRINT_DEBUG(("Didn't fit horizontally\n"));
 
             /* Restore the current window's frame */
             memcpy(cur, &tmp_frame, sizeof(rp_frame));
         } else {
             PRINT_DEBUG(("It fit horizontally!!\n"));
+            covered += cur->width * cur->height - cur_area;
             fits = 1;
         }
 
@@ -746,6 +1405,7 @@ void set_active_frame(rp_frame *frame, int force_indicator)
     give_window_focus(win, old_win);
     update_last_access(frame);
     v->current_frame = frame->number;
+    format_focus_changed();
 
     /* If frame->win == NULL, then rp_current_screen is not updated. */
     rp_current_screen = v->screen;
@@ -900,19 +1560,22 @@ void show_frame_message(char *msg)
     sbuf_free(msgbuf);
 }
 
-rp_frame *find_frame_up(rp_frame *frame)
+/*
+ * Of the frames with side at pos, return the one whose position along the
+ * other axis, as given by along, is the closest to frame's.
+ */
+static rp_frame *
+find_frame_touching(rp_frame *frame, int side, int pos,
+                    int (*along)(rp_frame *))
 {
-    rp_frame *cur, *winner = NULL;
-    rp_vscreen *v = frame->vscreen;
-    int wingap = 0, curgap;
-
-    list_for_each_entry(cur, &v->frames, node) {
-        if (frame_top(frame) != frame_bottom(cur))
-            continue;
+    rp_frame **found, *winner = NULL;
+    int i, n, wingap = 0, curgap;
 
-        curgap = abs(frame_left(frame) - frame_left(cur));
+    n = frames_at(frame->vscreen, side, pos, &found);
+    for (i = 0; i < n; i++) {
+        curgap = abs((*along) (frame) - (*along) (found[i]));
         if (!winner || (curgap < wingap)) {
-            winner = cur;
+            winner = found[i];
             wingap = curgap;
         }
     }
@@ -920,64 +1583,28 @@ rp_frame *find_frame_up(rp_frame *frame)
     return winner;
 }
 
-rp_frame *find_frame_down(rp_frame *frame)
+rp_frame *find_frame_up(rp_frame *frame)
 {
-    rp_frame *cur, *winner = NULL;
-    rp_vscreen *v = frame->vscreen;
-    int wingap = 0, curgap;
-
-    list_for_each_entry(cur, &v->frames, node) {
-        if (frame_bottom(frame) != frame_top(cur))
-            continue;
-
-        curgap = abs(frame_left(frame) - frame_left(cur));
-        if (!winner || (curgap < wingap)) {
-            winner = cur;
-            wingap = curgap;
-        }
-    }
+    return find_frame_touching(frame, SIDE_BOTTOM, frame_top(frame),
+                               frame_left);
+}
 
-    return winner;
+rp_frame *find_frame_down(rp_frame *frame)
+{
+    return find_frame_touching(frame, SIDE_TOP, frame_bottom(frame),
+                               frame_left);
 }
 
 rp_frame *find_frame_left(rp_frame *frame)
 {
-    rp_frame *cur, *winner = NULL;
-    rp_vscreen *v = frame->vscreen;
-    int wingap = 0, curgap;
-
-    list_for_each_entry(cur, &v->frames, node) {
-        if (frame_left(frame) != frame_right(cur))
-            continue;
-
-        curgap = abs(frame_top(frame) - frame_top(cur));
-        if (!winner || (curgap < wingap)) {
-            winner = cur;
-            wingap = curgap;
-        }
-    }
-
-    return winner;
+    return find_frame_touching(frame, SIDE_RIGHT, frame_left(frame),
+                               frame_top);
 }
 
 rp_frame *find_frame_right(rp_frame *frame)
 {
-    rp_frame *cur, *winner = NULL;
-    rp_vscreen *v = frame->vscreen;
-    int wingap = 0, curgap;
-
-    list_for_each_entry(cur, &v->frames, node) {
-        if (frame_right(frame) != frame_left(cur))
-            continue;
-
-        curgap = abs(frame_top(frame) - frame_top(cur));
-        if (!winner || (curgap < wingap)) {
-            winner = cur;
-            wingap = curgap;
-        }
-    }
-
-    return winner;
+    return find_frame_touching(frame, SIDE_LEFT, frame_right(frame),
+                               frame_top);
 }
 
 rp_frame *find_frame_number(rp_vscreen *v, int num)
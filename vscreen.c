@@ -29,6 +29,12 @@ void init_vscreen(rp_vscreen *v, rp_screen *s)
     v->numset = numset_new();
     v->last_access = 0;
 
+    memset(v->frame_index, 0, sizeof(v->frame_index));
+    v->frame_index_len = v->frame_index_size = 0;
+    v->frame_index_valid = 0;
+    v->split_tree = NULL;
+    v->split_tree_stale = 1;
+
     if (v->number == 0)
         v->name = xstrdup(DEFAULT_VSCREEN_NAME);
     else
@@ -36,6 +42,8 @@ void init_vscreen(rp_vscreen *v, rp_screen *s)
 
     INIT_LIST_HEAD(&v->unmapped_windows);
     INIT_LIST_HEAD(&v->mapped_windows);
+    INIT_LIST_HEAD(&v->mru_windows);
+    frame_windows_changed(v);
 
     init_frame_list(v);
 }
@@ -69,9 +77,15 @@ void vscreen_free(rp_vscreen *v)
 {
     rp_frame *frame;
     struct list_head *iter, *tmp;
+    int side;
+
+    split_tree_forget(v);
 
     list_for_each_safe_entry(frame, iter, tmp, &v->frames, node)
         frame_free(v, frame);
+
+    for (side = 0; side < SIDES; side++)
+        free(v->frame_index[side]);
 }
 
 int vscreens_resize(int n)
@@ -81,6 +95,8 @@ int vscreens_resize(int n)
     rp_screen *scr;
     int x;
 
+    snapshot_touch();
+
     PRINT_DEBUG(("Resizing vscreens from %d to %d\n", defaults.vscreens,
                  n));
 
@@ -139,8 +155,11 @@ struct list_head *vscreen_copy_frameset(rp_vscreen *v)
 /* Set head as the frameset, deleting the existing one. */
 void vscreen_restore_frameset(rp_vscreen *v, struct list_head *head)
 {
+    split_tree_forget(v);
     frameset_free(&v->frames);
     INIT_LIST_HEAD(&v->frames);
+    frames_changed(v);
+    frame_windows_changed(v);
 
     /* Hook in our new frameset. */
     list_splice(head, &v->frames);
@@ -237,10 +256,13 @@ void set_current_vscreen(rp_vscreen *v)
 
         win->frame_number = frame->number;
 
-        maximize(win);
+        maximize_batched(win);
         unhide_window(win);
     }
 
+    /* Everything above went out in one go. */
+    XSync(dpy, False);
+
     set_window_focus(v->screen->key_window);
 
     if ((frame = current_frame(v)))
@@ -256,6 +278,31 @@ void set_current_vscreen(rp_vscreen *v)
     hook_run(&rp_switch_vscreen_hook);
 }
 
+/*
+ * Put a mapped window_elem in the vscreen's most recently used list, behind
+ * the windows that were focused after it.
+ */
+static void vscreen_mru_insert(rp_vscreen *v, rp_window_elem *we)
+{
+    rp_window_elem *cur;
+
+    we->vscreen = v;
+    list_for_each_entry(cur, &v->mru_windows, mru) {
+        if (cur->win->last_access <= we->win->last_access)
+            break;
+    }
+    list_add_tail(&we->mru, &cur->mru);
+}
+
+/* win was just focused, so it goes to the front of the list. */
+void vscreen_window_accessed(rp_window *win)
+{
+    rp_window_elem *we = win->elem;
+
+    if (we && !list_empty(&we->mru))
+        list_move(&we->mru, &we->vscreen->mru_windows);
+}
+
 void vscreen_move_window(rp_vscreen *to, rp_window *w)
 {
     rp_vscreen *from = w->vscreen;
@@ -272,6 +319,7 @@ void vscreen_move_window(rp_vscreen *to, rp_window *w)
     f = find_windows_frame(w);
     w->vscreen = to;
     w->sticky_frame = EMPTY;
+    snapshot_touch();
 
     /* Forget that this window was in the frame it was in */
     if (f)
@@ -280,6 +328,8 @@ void vscreen_move_window(rp_vscreen *to, rp_window *w)
     /* Keep the same number when moving between vscreens */
     list_del(&we->node);
     vscreen_insert_window(&to->mapped_windows, we);
+    list_del(&we->mru);
+    vscreen_mru_insert(to, we);
 
     if (to == rp_current_vscreen)
         set_active_window_force(w);
@@ -290,7 +340,7 @@ void vscreen_move_window(rp_vscreen *to, rp_window *w)
      * Update rp_children so that any new windows from this application
      * will appear on the vscreen we just moved to
      */
-    child = get_child_info(w->w, 0);
+    child = get_child_info(w, 0);
     if (!child)
         return;
 
@@ -367,6 +417,7 @@ void vscreen_rename(rp_vscreen *v, char *name)
 {
     free(v->name);
     v->name = xstrdup(name);
+    snapshot_touch();
 }
 
 rp_vscreen *vscreen_next_vscreen(rp_vscreen *vscreen)
@@ -475,6 +526,7 @@ void vscreen_resort_window(rp_vscreen *v, rp_window_elem *w)
     }
     list_del(&w->node);
     vscreen_insert_window(&v->mapped_windows, w);
+    snapshot_touch();
 }
 
 void vscreen_add_window(rp_vscreen *v, rp_window *w)
@@ -485,9 +537,13 @@ void vscreen_add_window(rp_vscreen *v, rp_window *w)
     we = xmalloc(sizeof(rp_window_elem));
     we->win = w;
     we->number = -1;
+    we->vscreen = v;
+    INIT_LIST_HEAD(&we->mru);
+    w->elem = we;
 
     /* Finally, add it to our list. */
     list_add_tail(&we->node, &v->unmapped_windows);
+    snapshot_touch();
 }
 
 void vscreen_map_window(rp_vscreen *v, rp_window *win)
@@ -506,6 +562,8 @@ void vscreen_map_window(rp_vscreen *v, rp_window *win)
         we->number = vscreen_window_counter++;
         list_del(&we->node);
         vscreen_insert_window(&v->mapped_windows, we);
+        vscreen_mru_insert(v, we);
+        snapshot_touch();
     }
 }
 
@@ -516,6 +574,8 @@ void vscreen_unmap_window(rp_vscreen *v, rp_window *win)
     we = vscreen_find_window(&v->mapped_windows, win);
     if (we) {
         list_move_tail(&we->node, &v->unmapped_windows);
+        list_del_init(&we->mru);
+        snapshot_touch();
     }
 }
 
@@ -524,10 +584,15 @@ void vscreen_del_window(rp_vscreen *v, rp_window *win)
     rp_window_elem *cur;
     struct list_head *iter, *tmp;
 
+    snapshot_touch();
+
     /* The assumption is that a window is unmapped before it's deleted. */
     list_for_each_safe_entry(cur, iter, tmp, &v->unmapped_windows, node) {
         if (cur->win == win) {
             list_del(&cur->node);
+            list_del(&cur->mru);
+            if (win->elem == cur)
+                win->elem = NULL;
             free(cur);
         }
     }
@@ -548,28 +613,22 @@ void vscreen_del_window(rp_vscreen *v, rp_window *win)
 rp_window *vscreen_last_window(rp_vscreen *v)
 {
     rp_frame *f;
-    rp_window_elem *most_recent = NULL;
     rp_window_elem *cur;
-    int last_access = 0;
+    rp_window *current = current_window();
 
+    /* The first window that can be shown is the one focused last. */
     f = current_frame(v);
-    list_for_each_entry(cur, &v->mapped_windows, node) {
+    list_for_each_entry(cur, &v->mru_windows, mru) {
         if (cur->win->sticky_frame != EMPTY &&
             (!f || (cur->win->sticky_frame != f->number)))
             continue;
 
-        if (cur->win->last_access >= last_access
-            && cur->win != current_window()
+        if (cur->win != current
             && !find_windows_frame(cur->win)
-            && (cur->win->vscreen == v || rp_have_xrandr)) {
-            most_recent = cur;
-            last_access = cur->win->last_access;
-        }
+            && (cur->win->vscreen == v || rp_have_xrandr))
+            return cur->win;
     }
 
-    if (most_recent)
-        return most_recent->win;
-
     return NULL;
 }
 
@@ -658,6 +717,7 @@ void vscreens_merge(rp_vscreen *from, rp_vscreen *to)
     list_for_each_safe_entry(cur, iter, tmp, &from->unmapped_windows, node) {
         list_del(&cur->node);
         list_add_tail(&cur->node, &to->unmapped_windows);
+        cur->vscreen = to;
     }
 
     /* Move the mapped windows. */
@@ -665,29 +725,24 @@ void vscreens_merge(rp_vscreen *from, rp_vscreen *to)
         /* Keep the same number when merging vscreens */
         list_del(&cur->node);
         vscreen_insert_window(&to->mapped_windows, cur);
+        list_del(&cur->mru);
+        vscreen_mru_insert(to, cur);
     }
 }
 
 /* Used by :cother / :iother  */
 rp_window *vscreen_last_window_by_class(rp_vscreen *v, char *class)
 {
-    int last_access = 0;
-    rp_window_elem *most_recent = NULL;
     rp_window_elem *cur;
+    rp_window *current = current_window();
 
-    list_for_each_entry(cur, &v->mapped_windows, node) {
-        if (cur->win->last_access >= last_access
-            && cur->win != current_window()
+    list_for_each_entry(cur, &v->mru_windows, mru) {
+        if (cur->win != current
             && !find_windows_frame(cur->win)
-            && strcmp(class, cur->win->res_class)) {
-            most_recent = cur;
-            last_access = cur->win->last_access;
-        }
+            && strcmp(class, cur->win->res_class))
+            return cur->win;
     }
 
-    if (most_recent)
-        return most_recent->win;
-
     return NULL;
 }
 
@@ -695,23 +750,16 @@ rp_window *vscreen_last_window_by_class(rp_vscreen *v, char *class)
 rp_window *vscreen_last_window_by_class_complement(rp_vscreen *v,
                                                    char *class)
 {
-    int last_access = 0;
-    rp_window_elem *most_recent = NULL;
     rp_window_elem *cur;
+    rp_window *current = current_window();
 
-    list_for_each_entry(cur, &v->mapped_windows, node) {
-        if (cur->win->last_access >= last_access
-            && cur->win != current_window()
+    list_for_each_entry(cur, &v->mru_windows, mru) {
+        if (cur->win != current
             && !find_windows_frame(cur->win)
-            && !strcmp(class, cur->win->res_class)) {
-            most_recent = cur;
-            last_access = cur->win->last_access;
-        }
+            && !strcmp(class, cur->win->res_class))
+            return cur->win;
     }
 
-    if (most_recent)
-        return most_recent->win;
-
     return NULL;
 }
 
@@ -31,17 +31,6 @@ LIST_HEAD(rp_mapped_window);
 
 static void set_active_window_body(rp_window * win, int force);
 
-/* Get the mouse position relative to the the specified window */
-static void get_mouse_position(rp_window *win, int *mouse_x, int *mouse_y)
-{
-    Window root_win, child_win;
-    int root_x, root_y;
-    unsigned int mask;
-
-    XQueryPointer(dpy, win->vscreen->screen->root, &root_win, &child_win,
-                  mouse_x, mouse_y, &root_x, &root_y, &mask);
-}
-
 void free_window(rp_window *w)
 {
     if (w == NULL)
@@ -51,6 +40,7 @@ void free_window(rp_window *w)
     free(w->res_name);
     free(w->res_class);
     free(w->wm_name);
+    format_forget_window(w);
 
     XFree(w->hints);
 
@@ -103,72 +93,25 @@ char *window_name(rp_window *win)
 }
 
 /*
- * Verify that the window is running on the same host as the window manager.
- * This prevents PID collisions from windows on different hosts.
+ * Find the child process behind win, adding it to the list if add is set. Its
+ * pid only counts if it runs on this host, so pids from other hosts can't be
+ * mistaken for ours.
  */
-struct rp_child_info *get_child_info(Window w, int add)
+struct rp_child_info *get_child_info(rp_window *win, int add)
 {
-    XResClientIdSpec specs;
-    XResClientIdValue *results = NULL;
     rp_child_info *cur;
-    unsigned long pid = 0;
-    long nresults;
-    int i;
-    char localhost[256];
-    char *client_machine = NULL;
-    int hostname_matches = 0;
-
-    /* Get local hostname for comparison */
-    if (gethostname(localhost, sizeof(localhost)) != 0)
-        localhost[0] = '\0';
-
-    if (!get_atom(w, _net_wm_pid, XA_CARDINAL, 0, &pid, 1, NULL)) {
-        PRINT_DEBUG(("Couldn't get _NET_WM_PID Property\n"));
-        specs.client = w;
-        specs.mask = XRES_CLIENT_ID_PID_MASK;
-        if (XResQueryClientIds(dpy, 1, &specs, &nresults,
-                               &results) != Success)
-            pid = 0;
-        else {
-            for (i = 0; i < nresults; i++) {
-                if (results[i].spec.mask != XRES_CLIENT_ID_PID_MASK)
-                    continue;
-
-                pid = *(CARD32 *) (results[i].value);
-                break;
-            }
-            XFree(results);
-        }
-    }
 
-    PRINT_DEBUG(("NET_WM_PID: %ld\n", pid));
-
-    if (pid) {
-        /*
-         * Check WM_CLIENT_MACHINE to verify the window is on the same host.
-         * If the property is not set, assume localhost for compatibility.
-         */
-        if (get_atom(w, XA_WM_CLIENT_MACHINE, XA_STRING, 0,
-                     (unsigned long *) &client_machine, 0, NULL)) {
-            if (client_machine && localhost[0] != '\0') {
-                hostname_matches =
-                    (strcmp(client_machine, localhost) == 0);
-                XFree(client_machine);
-            } else {
-                /* No client machine or localhost - assume local */
-                hostname_matches = 1;
-            }
-        } else {
-            /* Property not set - assume localhost for compatibility */
-            hostname_matches = 1;
-        }
+    /* The answer is kept until _NET_WM_PID or WM_CLIENT_MACHINE change. */
+    if (!win->pid_cached)
+        update_window_pid(win);
 
-        if (hostname_matches) {
+    if (win->pid) {
+        if (win->pid_local) {
             list_for_each_entry(cur, &rp_children, node)
-                if (pid == (unsigned long) cur->pid)
+                if (win->pid == (unsigned long) cur->pid)
                 return cur;
         } else {
-            PRINT_DEBUG(("Skipping PID %ld from remote host\n", pid));
+            PRINT_DEBUG(("Skipping PID %ld from remote host\n", win->pid));
         }
     }
 
@@ -176,7 +119,7 @@ struct rp_child_info *get_child_info(Window w, int add)
         return NULL;
 
     /* Only add child info if hostname matches (or couldn't be verified) */
-    if (!hostname_matches)
+    if (!win->pid_local)
         return NULL;
 
     /*
@@ -185,7 +128,7 @@ struct rp_child_info *get_child_info(Window w, int add)
      */
     cur = xmalloc(sizeof(rp_child_info));
     cur->cmd = NULL;
-    cur->pid = pid;
+    cur->pid = win->pid;
     cur->terminated = 0;
     cur->frame = current_frame(rp_current_vscreen);
     cur->vscreen = rp_current_vscreen;
@@ -210,6 +153,9 @@ rp_window *add_to_window_list(rp_screen *s, Window w)
     new_window->w = w;
     new_window->vscreen = s->current_vscreen;
     new_window->last_access = 0;
+    new_window->shown_in = NULL;
+    new_window->shown_generation = 0;
+    new_window->elem = NULL;
     new_window->state = WithdrawnState;
     new_window->number = -1;
     new_window->sticky_frame = EMPTY;
@@ -218,19 +164,20 @@ rp_window *add_to_window_list(rp_screen *s, Window w)
     new_window->named = 0;
     new_window->hints = XAllocSizeHints();
     new_window->colormap = DefaultColormap(dpy, s->screen_num);
-    new_window->transient = XGetTransientForHint(dpy, new_window->w,
-                                                 &new_window->transient_for);
-    PRINT_DEBUG(("transient %d\n", new_window->transient));
+    new_window->transient = 0;
+    new_window->transient_for = None;
     new_window->full_screen = 0;
     new_window->floated = 0;
     new_window->accepts_input = 1;      /* Default to accepting input */
     new_window->supports_wm_take_focus = 0;     /* Will be set during update */
     new_window->withdrawn_at = 0;       /* Will be set when window is withdrawn */
+    new_window->window_type = None;
+    new_window->pid_cached = 0;
+    new_window->fmt_generation = 0;
+    new_window->fmt_memo = NULL;
+    forget_window_type(w);
 
-    update_window_gravity(new_window);
-
-    get_mouse_position(new_window, &new_window->mouse_x,
-                       &new_window->mouse_y);
+    new_window->mouse_x = new_window->mouse_y = 0;
 
     XSelectInput(dpy, new_window->w, WIN_EVENTS);
 
@@ -247,7 +194,14 @@ rp_window *add_to_window_list(rp_screen *s, Window w)
     /* Add the window to the end of the unmapped list. */
     list_add_tail(&new_window->node, &rp_unmapped_window);
 
-    child_info = get_child_info(w, 1);
+    /*
+     * Read everything else in one round trip, after selecting for property
+     * changes so none can slip in between.
+     */
+    update_window_information(new_window);
+    PRINT_DEBUG(("transient %d\n", new_window->transient));
+
+    child_info = get_child_info(new_window, 1);
     if (child_info) {
         if (child_info->vscreen != new_window->vscreen &&
             !defaults.win_add_cur_vscreen)
@@ -418,6 +372,8 @@ void give_window_focus(rp_window *win, rp_window *last_win)
 
     counter++;
     win->last_access = counter;
+    vscreen_window_accessed(win);
+    format_focus_changed();
     unhide_window(win);
 
     if (defaults.warp) {
@@ -602,19 +558,20 @@ get_window_list(char *fmt, char *delim, struct sbuf *buffer,
                 int *mark_start, int *mark_end)
 {
     rp_window_elem *we;
+    rp_window *current;
 
     if (buffer == NULL)
         return;
 
     sbuf_clear(buffer);
-    find_window_other(rp_current_vscreen);
+    current = current_window();
 
     /* We only loop through the current vscreen to look for windows. */
     list_for_each_entry(we, &rp_current_vscreen->mapped_windows, node) {
         PRINT_DEBUG(("%d-%s\n", we->number, window_name(we->win)));
 
-        if (we->win == current_window())
-            *mark_start = strlen(sbuf_get(buffer));
+        if (we->win == current)
+            *mark_start = buffer->len;
 
         /*
          * A hack, pad the window with a space at the beginning and end
@@ -639,9 +596,8 @@ get_window_list(char *fmt, char *delim, struct sbuf *buffer,
         if (delim && we->node.next != &rp_current_vscreen->mapped_windows)
             sbuf_concat(buffer, delim);
 
-        if (we->win == current_window()) {
-            *mark_end = strlen(sbuf_get(buffer));
-        }
+        if (we->win == current)
+            *mark_end = buffer->len;
     }
 
     if (!strcmp(sbuf_get(buffer), "")) {
@@ -18,6 +18,8 @@
  */
 
 #include <err.h>
+#include <string.h>
+#include <time.h>
 #include <X11/extensions/Xrandr.h>
 
 #include "poison.h"
@@ -35,6 +37,32 @@ static int xrandr_evbase;
 #define XRANDR_MAJOR 1
 #define XRANDR_MINOR 3
 
+/*
+ * Output changes come in bursts, docking a laptop gives several in a row.
+ * They are only noted as they come, and applied together once none came
+ * for this many milliseconds.
+ */
+#define XRANDR_SETTLE_MS 100
+
+static int changes_pending;
+static long long changes_due;
+
+/*
+ * While changes are applied, the resources, the output infos and the
+ * primary output are fetched once and shared by xrandr_fill_screen().
+ */
+static XRRScreenResources *batch_res;
+static XRROutputInfo **batch_outinfo;
+static RROutput batch_primary;
+
+static long long now_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void init_xrandr(void)
 {
     int errbase, major, minor;
@@ -115,6 +143,22 @@ int xrandr_is_primary(rp_screen *screen)
     return 0;
 }
 
+/* The output's info in the batch, fetched the first time it's asked for. */
+static XRROutputInfo *batch_output_info(RROutput output)
+{
+    int i;
+
+    for (i = 0; i < batch_res->noutput; i++) {
+        if (batch_res->outputs[i] != output)
+            continue;
+        if (batch_outinfo[i] == NULL)
+            batch_outinfo[i] = XRRGetOutputInfo(dpy, batch_res, output);
+        return batch_outinfo[i];
+    }
+
+    return NULL;
+}
+
 void xrandr_fill_screen(int rr_output, rp_screen *screen)
 {
     XRRScreenResources *res;
@@ -122,10 +166,15 @@ void xrandr_fill_screen(int rr_output, rp_screen *screen)
     XRRCrtcInfo *crtinfo;
     RROutput primary;
 
-    res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy,
-                                                       DefaultScreen
-                                                       (dpy)));
-    outinfo = XRRGetOutputInfo(dpy, res, rr_output);
+    if (batch_res) {
+        res = batch_res;
+        outinfo = batch_output_info(rr_output);
+    } else {
+        res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy,
+                                                           DefaultScreen
+                                                           (dpy)));
+        outinfo = XRRGetOutputInfo(dpy, res, rr_output);
+    }
     if (!outinfo || !outinfo->crtc)
         goto free_res;
 
@@ -133,8 +182,11 @@ void xrandr_fill_screen(int rr_output, rp_screen *screen)
     if (!crtinfo)
         goto free_out;
 
-    primary =
-        XRRGetOutputPrimary(dpy, RootWindow(dpy, DefaultScreen(dpy)));
+    if (batch_res)
+        primary = batch_primary;
+    else
+        primary =
+            XRRGetOutputPrimary(dpy, RootWindow(dpy, DefaultScreen(dpy)));
     if ((RROutput) rr_output == primary)
         screen->xrandr.primary = 1;
     else
@@ -153,23 +205,32 @@ void xrandr_fill_screen(int rr_output, rp_screen *screen)
 
     XRRFreeCrtcInfo(crtinfo);
   free_out:
-    XRRFreeOutputInfo(outinfo);
+    if (!batch_res)
+        XRRFreeOutputInfo(outinfo);
   free_res:
-    XRRFreeScreenResources(res);
+    if (!batch_res)
+        XRRFreeScreenResources(res);
 }
 
-void xrandr_output_change(XRROutputChangeNotifyEvent *ev)
+/* Apply every output change noted since the last time. */
+static void xrandr_apply_changes(void)
 {
-    XRRScreenResources *res;
     XRROutputInfo *outinfo;
-    rp_screen *screen, *cur;
-
-    res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy,
-                                                       DefaultScreen
-                                                       (dpy)));
-    outinfo = XRRGetOutputInfo(dpy, res, ev->output);
-
-    screen = xrandr_screen_output(ev->output);
+    rp_screen *cur;
+    struct list_head *iter, *tmp;
+    int i, left, top, width, height;
+
+    changes_pending = 0;
+
+    batch_res = XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy,
+                                                             DefaultScreen
+                                                             (dpy)));
+    batch_outinfo = xmalloc((batch_res->noutput + 1) *
+                            sizeof(XRROutputInfo *));
+    memset(batch_outinfo, 0, (batch_res->noutput + 1) *
+           sizeof(XRROutputInfo *));
+    batch_primary =
+        XRRGetOutputPrimary(dpy, RootWindow(dpy, DefaultScreen(dpy)));
 
     /* bar might move if primary screen changed */
     list_for_each_entry(cur, &rp_screens, node)
@@ -177,30 +238,95 @@ void xrandr_output_change(XRROutputChangeNotifyEvent *ev)
 
     mark_edge_frames();
 
-    if (!screen && outinfo && outinfo->crtc) {
-        screen = screen_add(ev->output);
+    /* Screens whose output lost its crtc go away... */
+    list_for_each_safe_entry(cur, iter, tmp, &rp_screens, node) {
+        outinfo = batch_output_info(cur->xrandr.output);
+        if (outinfo && outinfo->crtc)
+            continue;
+
+        PRINT_DEBUG(("%s: Removing screen %s\n", __func__,
+                     cur->xrandr.name));
+        screen_del(cur);
+    }
+
+    /* ...and outputs that got one get a screen. */
+    for (i = 0; i < batch_res->noutput; i++) {
+        outinfo = batch_output_info(batch_res->outputs[i]);
+        if (!outinfo || !outinfo->crtc
+            || xrandr_screen_output(batch_res->outputs[i]))
+            continue;
+
+        cur = screen_add(batch_res->outputs[i]);
         screen_sort();
 #ifdef DEBUG
         PRINT_DEBUG(("%s: Added screen %s with crtc %lu\n", __func__,
-                     screen->xrandr.name, (unsigned long) outinfo->crtc));
+                     cur->xrandr.name, (unsigned long) outinfo->crtc));
 #else
-        (void) screen;
+        (void) cur;
 #endif
-    } else if (screen && (!outinfo || !outinfo->crtc)) {
-        PRINT_DEBUG(("%s: Removing screen %s\n", __func__,
-                     screen->xrandr.name));
-        screen_del(screen);
     }
 
-    if (outinfo)
-        XRRFreeOutputInfo(outinfo);
-    XRRFreeScreenResources(res);
-
+    /*
+     * Only the screens that moved or changed size need their frames and
+     * windows laid out again. New screens start out laid out.
+     */
     list_for_each_entry(cur, &rp_screens, node) {
+        left = cur->left;
+        top = cur->top;
+        width = cur->width;
+        height = cur->height;
+
         xrandr_fill_screen(cur->xrandr.output, cur);
+        if (cur->left == left && cur->top == top
+            && cur->width == width && cur->height == height)
+            continue;
+
         screen_update_workarea(cur);
         screen_update_frames(cur);
     }
+
+    for (i = 0; i < batch_res->noutput; i++) {
+        if (batch_outinfo[i])
+            XRRFreeOutputInfo(batch_outinfo[i]);
+    }
+    free(batch_outinfo);
+    batch_outinfo = NULL;
+    XRRFreeScreenResources(batch_res);
+    batch_res = NULL;
+}
+
+void xrandr_output_change(XRROutputChangeNotifyEvent *ev)
+{
+    PRINT_DEBUG(("%s: output %lu changed\n", __func__,
+                 (unsigned long) ev->output));
+#ifndef DEBUG
+    (void) ev;
+#endif
+
+    changes_pending = 1;
+    changes_due = now_msec() + XRANDR_SETTLE_MS;
+}
+
+/*
+ * How long the main loop may wait before xrandr_settle() has work, in
+ * milliseconds, or -1 for as long as it likes.
+ */
+int xrandr_settle_timeout(void)
+{
+    long long left;
+
+    if (!changes_pending)
+        return -1;
+
+    left = changes_due - now_msec();
+    return left > 0 ? (int) left : 0;
+}
+
+/* Apply the output changes once they stopped coming. */
+void xrandr_settle(void)
+{
+    if (changes_pending && xrandr_settle_timeout() == 0)
+        xrandr_apply_changes();
 }
 
 #ifdef DEBUG